@@ -6,6 +6,10 @@ BINFINAL="$CUR_DIR"/bin
 
 echo "Running build script..."
 
+# Extra compiler flags, e.g. `CFLAGS=-DBENCHMARK ./build.sh` to run the boot benchmarks,
+# or -DPROFILE to profile the boot
+CFLAGS=${CFLAGS:-}
+
 rm -rf bin
 mkdir -p bin/misc
 
@@ -18,36 +22,83 @@ while IFS= read -r -d '' file; do
     printf "\n================================[ %s ]======================\n\n" "$file"
     if [[ "$file" == *".c" ]]; then
         flat_filename=OUT$(echo "$file" | tr '/' '__' | tr '.' '_')
-        i386-elf-gcc -ffreestanding -c "$file" -o "$BIN"/"${flat_filename%.c}.o"
+        i386-elf-gcc -ffreestanding $CFLAGS -c "$file" -o "$BIN"/"${flat_filename%.c}.o"
         printf "\n"
         echo " output to file:  $BIN"/"${flat_filename%.c}.o"
     fi
 done
 
-# Assemble bootsector
-nasm -f bin boot/bootsect.asm -o "$BIN"/bootsect.bin
 nasm boot/kernel_entry.asm -f elf -o "$BIN"/kernel_entry.o
 # Link and create image binary
 printf "\n================================[ Linking ]======================\n\n"
-i386-elf-ld -o "$BIN"/kernel.bin -Ttext 0x1000 -e 0x0 "$BIN"/*.o --oformat binary
+
+# Symbol table for the profiler, sorted by address. Reads `nm -n` output and
+# ends the table with the end of the text (etext, or else the first symbol
+# after the functions), which isn't counted
+writeSymbols() {
+    awk 'BEGIN { print "typedef struct { unsigned long address; const char *name; } ProfilerSymbol;";
+                 print "const ProfilerSymbol profilerSymbols[] = {" }
+         $3 == "etext" { end = $1 }
+         $2 !~ /^[tT]$/ && n && !end { end = $1 }
+         $2 ~ /^[tT]$/ && $3 !~ /^_*etext$/ { printf "    { 0x%s, \"%s\" },\n", $1, $3; n++ }
+         END { printf "    { 0x%s, 0 }\n};\n", end ? end : "0";
+               printf "const unsigned long profilerSymbolCount = %d;\n", n }' > "$BIN"/symbols/symbols.c
+    i386-elf-gcc -ffreestanding -c "$BIN"/symbols/symbols.c -o "$BIN"/symbols/symbols.o
+}
+
+# The table only adds read-only data after everything else, so linking once
+# with an empty one shows where the functions end up
+mkdir -p "$BIN"/symbols
+writeSymbols < /dev/null
+i386-elf-ld -o "$BIN"/kernel.elf -Ttext 0x1000 -e 0x0 "$BIN"/*.o "$BIN"/symbols/symbols.o
+i386-elf-nm -n "$BIN"/kernel.elf | writeSymbols
+# Link both again with the full table, so kernel.elf matches kernel.bin
+i386-elf-ld -o "$BIN"/kernel.elf -Ttext 0x1000 -e 0x0 "$BIN"/*.o "$BIN"/symbols/symbols.o
+i386-elf-ld -o "$BIN"/kernel.bin -Ttext 0x1000 -e 0x0 "$BIN"/*.o "$BIN"/symbols/symbols.o --oformat binary
+
+# The loader reads exactly the sectors the image needs, and it has to fit,
+# BSS included, below the SMP trampoline at 0x70000
+KERNELBYTES=$(wc -c < "$BIN"/kernel.bin)
+KERNEL_SECTORS=$(( (KERNELBYTES + 511) / 512 ))
+KERNEL_END=$(i386-elf-nm "$BIN"/kernel.elf | awk '$3 == "_end" { print $1 }')
+if (( 0x${KERNEL_END:-0} > 0x70000 )); then
+    echo "Kernel ends at 0x$KERNEL_END, past the SMP trampoline at 0x70000"
+    exit 1
+fi
+# FAT16 starts after the reserved sectors, which must cover the boot sector and the kernel
+RESERVED_SECTORS=$(( KERNEL_SECTORS + 1 > 128 ? KERNEL_SECTORS + 1 : 128 ))
+
+# Assemble bootsector
+nasm -f bin -DKERNEL_SECTORS=$KERNEL_SECTORS -DRESERVED_SECTORS=$RESERVED_SECTORS \
+     boot/bootsect.asm -o "$BIN"/bootsect.bin
 
 dd if=/dev/zero of="$BINFINAL"/vainos.img bs=1M count=128
 
 dd if="$BIN"/bootsect.bin of="$BINFINAL"/vainos.img bs=512 count=1 conv=notrunc
 dd if="$BIN"/kernel.bin of="$BINFINAL"/vainos.img bs=512 seek=1 conv=notrunc
-KERNELBYTES=$(wc -c < "$BIN"/kernel.bin)
+cp "$BIN"/kernel.bin "$BINFINAL"/kernel.bin
 printf "\n"
-echo "Sectors used by kernel:" $((KERNELBYTES/512))
+echo "Sectors used by kernel:" $KERNEL_SECTORS
 printf "\n"
 #cat "$BIN"/bootsect.bin "$BIN"/kernel.bin >> "$BINFINAL"/vainos.img
 
 cd "$CUR_DIR" || exit
 
+# `QEMU_BOOT=kernel ./build.sh` skips the boot sector: QEMU loads kernel.bin as
+# a Multiboot image, with QEMU_APPEND as its command line. The filesystem
+# still comes from the disk image
+BOOT_ARGS=()
+if [[ "${QEMU_BOOT:-disk}" == "kernel" ]]; then
+    BOOT_ARGS=(-kernel bin/kernel.bin -append "${QEMU_APPEND:-}")
+fi
+
 # Run image to setup the rootfs. It will try to reboot automatically.
 qemu-system-i386 -D ./log.txt \
                  -d cpu_reset \
                  -no-reboot \
                  -vga std \
+                 -serial stdio \
+                 "${BOOT_ARGS[@]}" \
                  -drive id=disk,format=raw,file=bin/vainos.img
 
 mkdir vainos_mount
@@ -63,4 +114,6 @@ qemu-system-i386 -D ./log.txt \
                  -d cpu_reset \
                  -no-reboot \
                  -vga std \
+                 -serial stdio \
+                 "${BOOT_ARGS[@]}" \
                  -drive id=disk,format=raw,file=bin/vainos.img
\ No newline at end of file
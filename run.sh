@@ -1,6 +1,16 @@
 #! /bin/bash
+# `QEMU_BOOT=kernel ./run.sh` boots bin/kernel.bin directly as a Multiboot
+# image, skipping the boot sector, with QEMU_APPEND as its command line
+BOOT_ARGS=()
+if [[ "${QEMU_BOOT:-disk}" == "kernel" ]]; then
+    BOOT_ARGS=(-kernel bin/kernel.bin -append "${QEMU_APPEND:-}")
+fi
+
 qemu-system-i386 -D ./log.txt \
                  -d cpu_reset \
                  -no-reboot \
                  -vga std \
+                 -serial stdio \
+                 -smp 4 \
+                 "${BOOT_ARGS[@]}" \
                  -drive id=disk,format=raw,file=bin/vainos.img
\ No newline at end of file
@@ -1,6 +1,22 @@
-[org 0x7c00]
+[org 0x0600] ; Where the boot sector moves itself, see bootsect_code
 [bits 16]
 
+; build.sh passes the size of the kernel image, and the reserved sectors it
+; needs: nasm -DKERNEL_SECTORS=... -DRESERVED_SECTORS=...
+%ifndef KERNEL_SECTORS
+%error "KERNEL_SECTORS is set by build.sh"
+%endif
+%ifndef RESERVED_SECTORS
+%define RESERVED_SECTORS 128
+%endif
+%if KERNEL_SECTORS + 1 > RESERVED_SECTORS
+%error "The kernel doesn't fit in the reserved sectors"
+%endif
+; Loaded from 0x1000 up to the SMP trampoline at 0x70000
+%if KERNEL_SECTORS > (0x70000 - 0x1000) / 512
+%error "The kernel is too big to load below 0x70000"
+%endif
+
 jmp bootsect_code
 nop
 
@@ -10,8 +26,8 @@ db "vainos", 0, 0 ; 8 bytes, name of the operating system
 dw 512            ; 2 bytes, bytes per sector, each one is 512 bytes long
 db 4              ; every cluster on disk is 4 sectors long
                   ;     (default value generated by `mkfs.vfat -v -F16` from makefile)
-dw 64             ; 2 bytes, reserved sectors, used to calculate the starting
-                  ;     sector of the first FAT
+dw RESERVED_SECTORS ; 2 bytes, reserved sectors, used to calculate the starting
+                  ;     sector of the first FAT. The kernel lives in here
 db 1              ; 1 byte, numer of file allocation tables, the prefered
                   ;     amout is 2 for backup
 dw 512            ; 2 bytes, number of root directory entries (file or
@@ -51,11 +67,29 @@ times 0x3e - ($-$$) db 0
 bootsect_code:
 
 KERNEL_OFFSET equ 0x1000 ; The same one we used when linking the kernel
-
+RELOCATED equ 0x0600
+BOOT_STAMP equ 0x0500    ; Free memory between the BIOS data area and us
+
+; The kernel is loaded from 0x1000 on and is too big to stop short of 0x7c00,
+; so copy ourselves below it and keep the stack between us and the kernel
+xor ax, ax
+mov ds, ax
+mov es, ax
+mov ss, ax
+mov sp, KERNEL_OFFSET
+mov si, 0x7c00
+mov di, RELOCATED
+mov cx, 256
+cld
+rep movsw
+jmp 0:relocated
+relocated:
 
 mov [BOOT_DRIVE], dl ; Remember that the BIOS sets us the boot drive in 'dl' on boot
-mov bp, 0x9000
-mov sp, bp
+rdtsc                    ; When the boot started, for the kernel's boot report
+mov [BOOT_STAMP], eax    ; (kernel/boottime.h)
+mov [BOOT_STAMP + 4], edx
+mov bp, sp
 mov bx, MSG_REAL_MODE 
 call print
 call print_nl
@@ -76,10 +110,7 @@ load_kernel:
     call print
     call print_nl
 
-    mov bx, KERNEL_OFFSET ; Read from disk and store in 0x1000
-    mov dh, 48
-    mov dl, [BOOT_DRIVE]
-    call disk_load
+    call disk_load        ; Read exactly the kernel image to 0x1000
     ret
 
 [bits 32]
@@ -1,32 +1,37 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+; Read KERNEL_SECTORS sectors, from the one after the boot sector on, to
+; KERNEL_OFFSET with int 13h extended (LBA) reads of up to DISK_CHUNK sectors
+DISK_CHUNK equ 64 ; 32 KiB, keeps every read under the 127 sectors some BIOSes allow
+
     disk_load:
+        ; Every BIOS since the late 90s has the extensions, one without fails
+        ; the first read. Not checking (ah = 0x41) keeps the boot sector small
         pusha
-        ; reading from disk requires setting specific values in all registers
-        ; so we will overwrite our input parameters from 'dx'. Let's save it
-        ; to the stack for later use.
-        push dx
-    
-        mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-        mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
-        mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
-                     ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-        mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
-        ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
-        ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-        mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
-    
-        ; [es:bx] <- pointer to buffer where the data will be stored
-        ; caller sets it up for us, and it is actually the standard location for int 13h
+        mov di, KERNEL_SECTORS ; di <- sectors still to read
+    disk_next:
+        mov ax, DISK_CHUNK
+        cmp di, ax
+        jae disk_count
+        mov ax, di
+    disk_count:
+        mov [dap_count], ax
+        mov si, dap   ; ds:si <- disk address packet
+        mov ah, 0x42  ; ah <- int 0x13 function. 0x42 = 'extended read'
+        mov dl, [BOOT_DRIVE]
         int 0x13      ; BIOS interrupt
         jc disk_error ; if error (stored in the carry bit)
-    
-        pop dx
-        cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
-        jne sectors_error
+
+        mov ax, [dap_count] ; The BIOS leaves the # of sectors it read here
+        test ax, ax
+        jz sectors_error
+        sub di, ax
+        add [dap_lba], ax
+        shl ax, 5     ; sectors to paragraphs, the next read goes right after this one
+        add [dap_segment], ax
+        test di, di
+        jnz disk_next
         popa
         ret
-    
-    
+
     disk_error:
         mov bx, DISK_ERROR
         call print
@@ -34,13 +39,24 @@
         mov dh, ah ; ah = error code, dl = disk drive that dropped the error
         call print_hex ; check out the code at http://stanislavs.org/helppc/int_13-1.html
         jmp disk_loop
-    
+
     sectors_error:
         mov bx, SECTORS_ERROR
         call print
-    
+
     disk_loop:
         jmp $
-    
+
+    ; Disk address packet for int 0x13, ah = 0x42
+    dap:
+        db 0x10, 0                  ; Packet size, reserved
+    dap_count:
+        dw 0                        ; Sectors to read, then read
+        dw 0                        ; Buffer offset...
+    dap_segment:
+        dw KERNEL_OFFSET >> 4       ; ...and segment, a new one for every read
+    dap_lba:
+        dd 1, 0                     ; First sector, right after the boot sector
+
     DISK_ERROR: db "dsk err", 0
-    SECTORS_ERROR: db "bad #of sect", 0
\ No newline at end of file
+    SECTORS_ERROR: db "bad #of sect", 0
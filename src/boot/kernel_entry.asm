@@ -1,7 +1,85 @@
 [bits 32]
 
+; Two ways in: the boot sector calls the first byte, at 0x1000, and a
+; Multiboot loader (qemu -kernel bin/kernel.bin) jumps to multiboot_entry
+
+MULTIBOOT_MAGIC      equ 0x1BADB002
+MULTIBOOT_MEMORY_MAP equ 0x00000002 ; Ask for mem_* and the memory map
+MULTIBOOT_ADDRESSES  equ 0x00010000 ; kernel.bin is flat, so give the load addresses below
+MULTIBOOT_FLAGS      equ MULTIBOOT_MEMORY_MAP | MULTIBOOT_ADDRESSES
+KERNEL_OFFSET        equ 0x1000     ; Same as -Ttext in build.sh
+BOOT_STACK           equ 0x90000    ; Same as the boot sector's, see switch32.asm
+BOOT_STAMP_LOADER    equ 0x0500     ; TSC stamps, see kernel/boottime.h
+BOOT_STAMP_ENTRY     equ 0x0508
 
 [extern main] ; Define calling point. Must have same name as kernel.c 'main' function
+[extern __bss_start] ; Both from the linker's default script
+[extern _end]
+[extern multibootMagic]
+[extern multibootInfoAddress]
+
+jmp disk_entry
+
+; Has to be in the first 8 KiB of the image, 4 byte aligned
+align 4
+multiboot_header:
+    dd MULTIBOOT_MAGIC
+    dd MULTIBOOT_FLAGS
+    dd -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
+    dd multiboot_header ; header_addr
+    dd KERNEL_OFFSET    ; load_addr, the start of the file
+    dd 0                ; load_end_addr, 0 loads the whole file
+    dd _end             ; bss_end_addr
+    dd multiboot_entry  ; entry_addr
+
+; The loader leaves eax = 0x2BADB002 and ebx = the info structure, with flat
+; segments from a GDT of its own and no stack. smpInitBoot loads the real GDT,
+; this one only has to last until then
+multiboot_entry:
+    cli
+    lgdt [multiboot_gdtr]
+    jmp 0x08:.reload
+.reload:
+    mov cx, 0x10
+    mov ds, cx
+    mov es, cx
+    mov fs, cx
+    mov gs, cx
+    mov ss, cx
+    mov esp, BOOT_STACK
+    mov esi, eax
+    mov dword [BOOT_STAMP_LOADER], 0 ; The boot sector didn't run
+    mov dword [BOOT_STAMP_LOADER + 4], 0
+    jmp start_kernel
+
+disk_entry:
+    xor esi, esi ; No Multiboot info
+    xor ebx, ebx
+
+start_kernel:
+rdtsc
+mov [BOOT_STAMP_ENTRY], eax
+mov [BOOT_STAMP_ENTRY + 4], edx
+; The loader only reads the image, which ends before the BSS, so clear it
+mov edi, __bss_start
+mov ecx, _end
+sub ecx, edi
+xor eax, eax
+cld
+rep stosb
+mov [multibootMagic], esi
+mov [multibootInfoAddress], ebx
 call main ; Calls the C function. The linker will know where it is placed in memory
 jmp $
-%include "cpu/interrupt.asm"
\ No newline at end of file
+
+align 8
+multiboot_gdt:      ; Flat code and data, like boot/gdt32.asm
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+multiboot_gdtr:
+    dw 3 * 8 - 1
+    dd multiboot_gdt
+
+%include "cpu/interrupt.asm"
+%include "cpu/trampoline.asm"
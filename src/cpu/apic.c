@@ -0,0 +1,319 @@
+#include "apic.h"
+
+#include "utils.h"
+#include "../drivers/ports.h"
+#include "../libc/mem.h"
+#include "../debug.h"
+
+#define CPUID_FEAT_EDX_APIC (1 << 9)
+#define MSR_APIC_BASE 0x1B
+#define MSR_APIC_BASE_ENABLE (1 << 11)
+
+// Local APIC registers, offsets from its MMIO base
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ICR_LOW   0x300
+#define LAPIC_ICR_HIGH  0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define LAPIC_ICR_INIT    0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_ASSERT  0x4000
+#define LAPIC_ICR_PENDING 0x1000
+
+// I/O APIC registers, reached through the select and window registers
+#define IOAPIC_SELECT 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10
+
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL      0x8000
+#define IOAPIC_MASKED     0x10000
+
+// MADT entry types and interrupt source override flags
+#define MADT_LAPIC    0
+#define MADT_IOAPIC   1
+#define MADT_OVERRIDE 2
+#define MADT_POLARITY_LOW 0x3
+#define MADT_TRIGGER_LEVEL 0xC
+
+#define ISA_IRQS 16
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[6];
+    char oemTable[8];
+    uint32_t oemRevision;
+    uint32_t creator;
+    uint32_t creatorRevision;
+} __attribute__((packed)) AcpiHeader;
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem[6];
+    uint8_t revision;
+    uint32_t rsdt;
+} __attribute__((packed)) AcpiRsdp;
+
+typedef struct {
+    uint32_t base;
+    uint32_t gsiBase;
+    uint32_t gsiCount;
+} IoApic;
+
+// Where an ISA IRQ ends up on the I/O APICs
+typedef struct {
+    uint32_t gsi;
+    uint32_t flags;     // IOAPIC_ACTIVE_LOW and IOAPIC_LEVEL
+} IsaRoute;
+
+static bool enabled = false;
+static volatile uint32_t *lapic = NULL;
+
+static IoApic ioapics[APIC_MAX_IOAPICS];
+static uint32_t ioapicCount = 0;
+static IsaRoute isaRoutes[ISA_IRQS];
+
+static uint8_t cpuIds[APIC_MAX_CPUS];
+static uint32_t cpuCount = 0;
+
+static inline uint32_t lapicRead(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapicWrite(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+static uint32_t ioapicRead(IoApic *ioapic, uint32_t reg) {
+    volatile uint32_t *base = (volatile uint32_t *)ioapic->base;
+    base[IOAPIC_SELECT / 4] = reg;
+    return base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapicWrite(IoApic *ioapic, uint32_t reg, uint32_t value) {
+    volatile uint32_t *base = (volatile uint32_t *)ioapic->base;
+    base[IOAPIC_SELECT / 4] = reg;
+    base[IOAPIC_WINDOW / 4] = value;
+}
+
+static IoApic *ioapicForGsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapicCount; i++)
+        if (gsi >= ioapics[i].gsiBase && gsi < ioapics[i].gsiBase + ioapics[i].gsiCount)
+            return &ioapics[i];
+    return NULL;
+}
+
+static bool checksumOK(byte *table, uint32_t length) {
+    byte sum = 0;
+    for (uint32_t i = 0; i < length; i++)
+        sum += table[i];
+    return sum == 0;
+}
+
+static AcpiRsdp *findRsdpIn(uint32_t start, uint32_t length) {
+    for (uint32_t address = start; address < start + length; address += 16) {
+        AcpiRsdp *rsdp = (AcpiRsdp *)address;
+        if (memequal(rsdp->signature, "RSD PTR ", 8) && checksumOK((byte *)rsdp, sizeof(AcpiRsdp)))
+            return rsdp;
+    }
+    return NULL;
+}
+
+// The RSDP is in the first KiB of the EBDA or in the BIOS area below 1 MiB
+static AcpiRsdp *findRsdp() {
+    uint32_t ebda = (uint32_t)(*(uint16_t *)0x40E) << 4;
+    AcpiRsdp *rsdp = NULL;
+    if (ebda)
+        rsdp = findRsdpIn(ebda, 1024);
+    if (rsdp == NULL)
+        rsdp = findRsdpIn(0xE0000, 0x20000);
+    return rsdp;
+}
+
+static AcpiHeader *findMadt() {
+    AcpiRsdp *rsdp = findRsdp();
+    if (rsdp == NULL)
+        return NULL;
+    AcpiHeader *rsdt = (AcpiHeader *)rsdp->rsdt;
+    if (!memequal(rsdt->signature, "RSDT", 4))
+        return NULL;
+
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+    uint32_t tableCount = (rsdt->length - sizeof(AcpiHeader)) / 4;
+    for (uint32_t i = 0; i < tableCount; i++) {
+        AcpiHeader *table = (AcpiHeader *)tables[i];
+        if (memequal(table->signature, "APIC", 4) && checksumOK((byte *)table, table->length))
+            return table;
+    }
+    return NULL;
+}
+
+static void parseMadt(AcpiHeader *madt) {
+    for (int irq = 0; irq < ISA_IRQS; irq++) {
+        isaRoutes[irq].gsi = irq;   // Identity mapped, edge triggered and active high unless overridden
+        isaRoutes[irq].flags = 0;
+    }
+
+    byte *entry = (byte *)madt + sizeof(AcpiHeader) + 8;   // Skip the LAPIC address and flags
+    byte *end = (byte *)madt + madt->length;
+    while (entry + 2 <= end && entry[1] >= 2) {
+        switch (entry[0]) {
+            case MADT_LAPIC:
+                // ACPI processor ID, APIC ID, flags (bit 0: enabled)
+                if ((*(uint32_t *)(entry + 4) & 1) && cpuCount < APIC_MAX_CPUS)
+                    cpuIds[cpuCount++] = entry[3];
+                break;
+            case MADT_IOAPIC:
+                if (ioapicCount < APIC_MAX_IOAPICS) {
+                    IoApic *ioapic = &ioapics[ioapicCount++];
+                    ioapic->base = *(uint32_t *)(entry + 4);
+                    ioapic->gsiBase = *(uint32_t *)(entry + 8);
+                    ioapic->gsiCount = ((ioapicRead(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+                }
+                break;
+            case MADT_OVERRIDE: {
+                // Bus, source IRQ, GSI, flags
+                uint8_t irq = entry[3];
+                uint16_t flags = *(uint16_t *)(entry + 8);
+                if (irq < ISA_IRQS) {
+                    isaRoutes[irq].gsi = *(uint32_t *)(entry + 4);
+                    isaRoutes[irq].flags = 0;
+                    if ((flags & MADT_POLARITY_LOW) == MADT_POLARITY_LOW)
+                        isaRoutes[irq].flags |= IOAPIC_ACTIVE_LOW;
+                    if ((flags & MADT_TRIGGER_LEVEL) == MADT_TRIGGER_LEVEL)
+                        isaRoutes[irq].flags |= IOAPIC_LEVEL;
+                }
+                break;
+            }
+        }
+        entry += entry[1];
+    }
+}
+
+bool apicInit() {
+    uint32_t edx = 0;
+    if (hasCPUID())
+        cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_FEAT_EDX_APIC))
+        return false;
+
+    AcpiHeader *madt = findMadt();
+    if (madt == NULL)
+        return false;
+    parseMadt(madt);
+    if (ioapicCount == 0) {
+        LOG_WARN(LOG_CAT_CPU, "MADT lists no I/O APIC, keeping the PIC");
+        return false;
+    }
+
+    apicInitLocal();
+
+    // Silence the PIC, it still delivers spurious IRQs to its remapped vectors
+    portByteOut(0x21, 0xFF);
+    portByteOut(0xA1, 0xFF);
+
+    // Everything starts out masked, then the ISA IRQs take over the PIC's vectors
+    for (uint32_t i = 0; i < ioapicCount; i++)
+        for (uint32_t pin = 0; pin < ioapics[i].gsiCount; pin++)
+            ioapicWrite(&ioapics[i], IOAPIC_REDIRECTION + pin * 2, IOAPIC_MASKED);
+    for (uint8_t irq = 0; irq < ISA_IRQS; irq++)
+        if (irq != 2)   // The PIC cascade, nothing behind it anymore
+            apicRouteIrq(irq, 32 + irq);
+
+    enabled = true;
+    return true;
+}
+
+void apicInitLocal() {
+    uint64_t base = readMSR(MSR_APIC_BASE);
+    writeMSR(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+    lapic = (volatile uint32_t *)((uint32_t)base & 0xFFFFF000);
+
+    lapicWrite(LAPIC_TPR, 0);
+    lapicWrite(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | APIC_TIMER_VECTOR);
+    lapicWrite(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapicWrite(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+bool apicEnabled() {
+    return enabled;
+}
+
+void apicEOI() {
+    lapicWrite(LAPIC_EOI, 0);
+}
+
+uint8_t apicId() {
+    return (uint8_t)(lapicRead(LAPIC_ID) >> 24);
+}
+
+uint32_t apicCpuCount() {
+    return cpuCount;
+}
+
+uint8_t apicCpuId(uint32_t index) {
+    return cpuIds[index];
+}
+
+void apicRouteIrq(uint8_t irq, uint8_t vector) {
+    IsaRoute *route = &isaRoutes[irq & (ISA_IRQS - 1)];
+    IoApic *ioapic = ioapicForGsi(route->gsi);
+    if (ioapic == NULL)
+        return;
+    uint32_t reg = IOAPIC_REDIRECTION + (route->gsi - ioapic->gsiBase) * 2;
+    // Fixed delivery, physical destination: the CPU we're booting on
+    ioapicWrite(ioapic, reg + 1, (uint32_t)apicId() << 24);
+    ioapicWrite(ioapic, reg, vector | route->flags);
+}
+
+void apicMaskIrq(uint8_t irq, bool masked) {
+    IsaRoute *route = &isaRoutes[irq & (ISA_IRQS - 1)];
+    IoApic *ioapic = ioapicForGsi(route->gsi);
+    if (ioapic == NULL)
+        return;
+    uint32_t reg = IOAPIC_REDIRECTION + (route->gsi - ioapic->gsiBase) * 2;
+    uint32_t low = ioapicRead(ioapic, reg);
+    ioapicWrite(ioapic, reg, masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED));
+}
+
+void apicTimerOneShot(uint32_t count) {
+    lapicWrite(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+    lapicWrite(LAPIC_TIMER_INITIAL, count);
+}
+
+uint32_t apicTimerCurrent() {
+    return lapicRead(LAPIC_TIMER_CURRENT);
+}
+
+static void sendIPI(uint8_t apicId, uint32_t command) {
+    lapicWrite(LAPIC_ICR_HIGH, (uint32_t)apicId << 24);
+    lapicWrite(LAPIC_ICR_LOW, command);
+    while (lapicRead(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {}
+}
+
+void apicSendIPI(uint8_t apicId, uint8_t vector) {
+    sendIPI(apicId, LAPIC_ICR_ASSERT | vector);
+}
+
+void apicSendInit(uint8_t apicId) {
+    sendIPI(apicId, LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+}
+
+void apicSendStartup(uint8_t apicId, uint8_t page) {
+    sendIPI(apicId, LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | page);
+}
@@ -0,0 +1,50 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "../types.h"
+
+/* Local APIC and I/O APIC support. apicInit finds them through the ACPI MADT,
+ * masks the 8259 PIC and routes the ISA IRQs through the I/O APIC to the
+ * vectors the PIC used (IRQ0..IRQ15), so handlers don't change. Without an
+ * APIC or a MADT the PIC stays in charge. */
+
+#define APIC_TIMER_VECTOR    49
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+#define APIC_MAX_CPUS    16
+#define APIC_MAX_IOAPICS 4
+
+/* Returns whether the APICs took over from the PIC. Call after the PIC has been remapped */
+bool apicInit();
+
+/* Enable the local APIC of the calling CPU, apicInit does it for the boot CPU */
+void apicInitLocal();
+
+bool apicEnabled();
+
+/* Signal the end of an interrupt to the local APIC */
+void apicEOI();
+
+/* ID of the local APIC of the running CPU */
+uint8_t apicId();
+
+/* Local APIC IDs of the enabled CPUs listed in the MADT, the boot CPU included */
+uint32_t apicCpuCount();
+uint8_t apicCpuId(uint32_t index);
+
+/* Deliver ISA IRQ `irq` (after any MADT override) as `vector` to the boot CPU */
+void apicRouteIrq(uint8_t irq, uint8_t vector);
+
+void apicMaskIrq(uint8_t irq, bool masked);
+
+/* Inter-processor interrupts. The startup IPI starts a CPU in real mode at page * 4096 */
+void apicSendIPI(uint8_t apicId, uint8_t vector);
+void apicSendInit(uint8_t apicId);
+void apicSendStartup(uint8_t apicId, uint8_t page);
+
+/* Local APIC timer in one-shot mode, counting down at the bus clock divided by 16.
+ * init_timer measures that rate. A count of 0 stops it */
+void apicTimerOneShot(uint32_t count);
+uint32_t apicTimerCurrent();
+
+#endif // APIC_H
@@ -0,0 +1,40 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "../types.h"
+
+/* Atomic operations shared between CPUs. The kernel is built for the i386,
+ * which lacks cmpxchg and xadd, so GCC turns its __sync builtins into library
+ * calls we don't have. Every CPU we start has them, so they're written out here */
+
+/* Keeps the compiler from moving memory accesses across it. Enough on x86 for
+ * everything but a store followed by a load of another location */
+static inline void compilerBarrier() {
+    __asm__ __volatile__("" : : : "memory");
+}
+
+/* Full barrier, orders earlier stores before later loads. mfence needs SSE2 */
+static inline void atomicFence() {
+    __asm__ __volatile__("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+/* Store `desired` if `*ptr` still holds `expected`, returns whether it did */
+static inline bool atomicCompareExchange(volatile uint32_t *ptr, uint32_t expected, uint32_t desired) {
+    uint32_t previous;
+    __asm__ __volatile__("lock; cmpxchgl %2, %1"
+                         : "=a" (previous), "+m" (*ptr)
+                         : "r" (desired), "0" (expected)
+                         : "memory", "cc");
+    return previous == expected;
+}
+
+/* Add `value` and return what `*ptr` held before */
+static inline uint32_t atomicFetchAdd(volatile uint32_t *ptr, uint32_t value) {
+    __asm__ __volatile__("lock; xaddl %0, %1"
+                         : "+r" (value), "+m" (*ptr)
+                         :
+                         : "memory", "cc");
+    return value;
+}
+
+#endif // ATOMIC_H
@@ -0,0 +1,36 @@
+#include "fpu.h"
+#include "utils.h"
+#include "../libc/mem.h"
+
+#define CR0_MP (1 << 1) /* Monitor coprocessor */
+#define CR0_EM (1 << 2) /* x87 emulation, must be off */
+#define CR0_NE (1 << 5) /* Native FPU exceptions */
+
+#define CR4_OSFXSR     (1 << 9)  /* fxsave/fxrstor and SSE instructions */
+#define CR4_OSXMMEXCPT (1 << 10) /* Unmasked SSE exceptions */
+
+bool init_fpu() {
+    uint32_t cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    __asm__ __volatile__("mov %0, %%cr0" : : "r" (cr0));
+    __asm__ __volatile__("fninit");
+
+    if (!hasCPUID())
+        return false;
+
+    uint32_t features;
+    cpuid(1, NULL, NULL, NULL, &features);
+    uint32_t required = CPUID_FEAT_EDX_FXSR | CPUID_FEAT_EDX_SSE | CPUID_FEAT_EDX_SSE2;
+    if ((features & required) != required)
+        return false;
+
+    uint32_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ __volatile__("mov %0, %%cr4" : : "r" (cr4));
+
+    memEnableSSE();
+    return true;
+}
@@ -0,0 +1,14 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "../types.h"
+
+#define CPUID_FEAT_EDX_FXSR (1 << 24)
+#define CPUID_FEAT_EDX_SSE  (1 << 25)
+#define CPUID_FEAT_EDX_SSE2 (1 << 26)
+
+/* Initialize the x87 FPU and, if the CPU has SSE2, enable SSE.
+ * Returns whether SSE2 was enabled */
+bool init_fpu();
+
+#endif // FPU_H
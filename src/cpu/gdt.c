@@ -0,0 +1,44 @@
+#include "gdt.h"
+
+#define GDT_ACCESS_CODE 0x9A    // Present, ring 0, code, readable
+#define GDT_ACCESS_DATA 0x92    // Present, ring 0, data, writable
+#define GDT_FLAGS_4K_32 0xC0    // 4 KiB granularity, 32-bit
+#define GDT_FLAGS_32    0x40    // Byte granularity, 32-bit
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) GdtRegister;
+
+static void setEntry(GdtEntry *entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    entry->limitLow = (uint16_t)(limit & 0xFFFF);
+    entry->baseLow = (uint16_t)(base & 0xFFFF);
+    entry->baseMiddle = (uint8_t)((base >> 16) & 0xFF);
+    entry->access = access;
+    entry->granularity = (uint8_t)(flags | ((limit >> 16) & 0x0F));
+    entry->baseHigh = (uint8_t)((base >> 24) & 0xFF);
+}
+
+void gdtLoad(GdtEntry *gdt, void *cpuData, uint32_t cpuDataSize) {
+    setEntry(&gdt[0], 0, 0, 0, 0);
+    setEntry(&gdt[1], 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAGS_4K_32);
+    setEntry(&gdt[2], 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAGS_4K_32);
+    setEntry(&gdt[3], (uint32_t)cpuData, cpuDataSize - 1, GDT_ACCESS_DATA, GDT_FLAGS_32);
+
+    GdtRegister reg;
+    reg.limit = GDT_ENTRIES * sizeof(GdtEntry) - 1;
+    reg.base = (uint32_t)gdt;
+    __asm__ __volatile__(
+        "lgdtl (%0)\n\t"
+        "ljmp %1, $1f\n"        // Reload CS from the new table
+        "1:\n\t"
+        "movw %2, %%ax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%ss\n\t"
+        "movw %3, %%ax\n\t"
+        "movw %%ax, %%gs"
+        : : "r" (&reg), "i" (GDT_KERNEL_CODE), "i" (GDT_KERNEL_DATA), "i" (GDT_CPU_DATA)
+        : "eax", "memory");
+}
@@ -0,0 +1,26 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "../types.h"
+
+/* Every CPU loads its own GDT: flat kernel code and data, plus a data segment
+ * based at the CPU's per-CPU area, which stays loaded in GS */
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_CPU_DATA    0x18
+#define GDT_ENTRIES     4
+
+typedef struct {
+    uint16_t limitLow;
+    uint16_t baseLow;
+    uint8_t baseMiddle;
+    uint8_t access;
+    uint8_t granularity;    // High 4 bits of the limit and the flags
+    uint8_t baseHigh;
+} __attribute__((packed)) GdtEntry;
+
+/* Fill `gdt` and load it on the calling CPU, with GS based at `cpuData` */
+void gdtLoad(GdtEntry *gdt, void *cpuData, uint32_t cpuDataSize);
+
+#endif // GDT_H
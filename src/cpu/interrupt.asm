@@ -10,19 +10,17 @@ isr_common_stub:
 	push eax ; save the data segment descriptor
 	mov ax, 0x10  ; kernel data segment descriptor
 	mov ds, ax
-	mov es, ax
-	mov fs, ax
-	mov gs, ax
+	mov es, ax ; fs and gs are left alone, gs points at the per-CPU area
 	
     ; 2. Call C handler
+	push esp ; registers_t* for isr_handler, the frame isn't copied
 	call isr_handler
+	add esp, 4
 	
     ; 3. Restore state
 	pop eax 
 	mov ds, ax
 	mov es, ax
-	mov fs, ax
-	mov gs, ax
 	popa
 	add esp, 8 ; Cleans up the pushed error code and pushed ISR number
 	sti
@@ -37,14 +35,12 @@ irq_common_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
+    push esp ; registers_t* for irq_handler
     call irq_handler ; Different than the ISR code
+    mov esp, eax ; irq_handler returns the frame to resume, which may belong to another thread
     pop ebx  ; Different than the ISR code
     mov ds, bx
     mov es, bx
-    mov fs, bx
-    mov gs, bx
     popa
     add esp, 8
     sti
@@ -107,6 +103,11 @@ global irq12
 global irq13
 global irq14
 global irq15
+; Software interrupts
+global isr48
+global isr49
+global isr50
+global isr_spurious
 
 ; 0: Divide By Zero Exception
 isr0:
@@ -421,4 +422,29 @@ irq15:
 	cli
 	push byte 15
 	push byte 47
-	jmp irq_common_stub
\ No newline at end of file
+	jmp irq_common_stub
+
+; 48: Thread yield, enters the scheduler through the IRQ path
+isr48:
+	cli
+	push byte 0
+	push byte 48
+	jmp irq_common_stub
+
+; 49: Local APIC timer
+isr49:
+	cli
+	push byte 0
+	push byte 49
+	jmp irq_common_stub
+
+; 50: Inter-processor call, see smpCall
+isr50:
+	cli
+	push byte 0
+	push byte 50
+	jmp irq_common_stub
+
+; 255: Spurious local APIC interrupt, must not be acknowledged
+isr_spurious:
+	iret
@@ -1,10 +1,20 @@
 #include "isr.h"
 #include "idt.h"
+#include "apic.h"
+#include "smp.h"
+#include "timer.h"
+#include "utils.h"
 #include "../libc/mem.h"
 #include "../drivers/ports.h"
 #include "../drivers/vga.h"
+#include "../libc/printf.h"
+#include "../kernel/thread.h"
 
 isr_t interrupt_handlers[256];
+// Updated without locks, counts of the IPI vector taken on several CPUs at once can be lost
+static InterruptStats stats[256];
+// Frame of the outermost IRQ each CPU is handling
+static registers_t *irqFrames[SMP_MAX_CPUS];
 /* Can't do this with a loop because we need the address
  * of the function names */
 void isr_install() {
@@ -71,6 +81,14 @@ void isr_install() {
     set_idt_gate(46, (uint32_t)irq14);
     set_idt_gate(47, (uint32_t)irq15);
 
+    set_idt_gate(ISR_YIELD, (uint32_t)isr48);
+    set_idt_gate(APIC_TIMER_VECTOR, (uint32_t)isr49);
+    set_idt_gate(SMP_CALL_VECTOR, (uint32_t)isr50);
+    set_idt_gate(APIC_SPURIOUS_VECTOR, (uint32_t)isr_spurious);
+
+    // Hand the IRQs over to the APICs when there are any, the PIC stays as the fallback
+    apicInit();
+
     set_idt(); // Load with ASM
 }
 
@@ -113,22 +131,98 @@ char *exception_messages[] = {
     "Reserved"
 };
 
-void isr_handler(registers_t r) {
+// Cycles are only counted once the TSC has been found and calibrated
+static inline uint64_t statsStart() {
+    return getTSCFrequencyKHz() ? readTSC() : 0;
+}
+
+static inline void statsStop(uint32_t vector, uint64_t start) {
+    InterruptStats *entry = &stats[vector & 0xFF];
+    entry->count++;
+    if (start) {
+        uint32_t cycles = (uint32_t)(readTSC() - start);
+        entry->cycles += cycles;
+        if (cycles > entry->maxCycles)
+            entry->maxCycles = cycles;
+    }
+}
+
+void isr_handler(registers_t *r) {
+    uint64_t start = statsStart();
+    if (interrupt_handlers[r->int_no] != 0) {
+        isr_t handler = interrupt_handlers[r->int_no];
+        handler(r);
+    }
+    statsStop(r->int_no, start);
 }
 
 void register_interrupt_handler(uint8_t n, isr_t handler) {
     interrupt_handlers[n] = handler;
 }
 
-void irq_handler(registers_t r) {
-    /* After every interrupt we need to send an EOI to the PICs
-     * or they will not send another interrupt again */
-    if (r.int_no >= 40) portByteOut(0xA0, 0x20); /* slave */
-    portByteOut(0x20, 0x20); /* master */
+bool inInterrupt() {
+    return cpuCurrent()->irqDepth != 0;
+}
+
+registers_t *interruptFrame() {
+    return irqFrames[cpuCurrent()->index];
+}
+
+registers_t *irq_handler(registers_t *r) {
+    uint64_t start = statsStart();
+    /* After every interrupt we need to send an EOI to the interrupt controller
+     * or it will not send another interrupt again */
+    if (r->int_no != ISR_YIELD) {
+        if (apicEnabled()) {
+            apicEOI();
+        } else if (r->int_no <= IRQ15) {
+            if (r->int_no >= 40) portByteOut(0xA0, 0x20); /* slave */
+            portByteOut(0x20, 0x20); /* master */
+        }
+    }
 
     /* Handle the interrupt in a more modular way */
-    if (interrupt_handlers[r.int_no] != 0) {
-        isr_t handler = interrupt_handlers[r.int_no];
-        handler(&r);
+    if (interrupt_handlers[r->int_no] != 0) {
+        isr_t handler = interrupt_handlers[r->int_no];
+        Cpu *cpu = cpuCurrent();
+        if (cpu->irqDepth++ == 0)
+            irqFrames[cpu->index] = r;
+        handler(r);
+        if (--cpu->irqDepth == 0)
+            irqFrames[cpu->index] = NULL;
+    }
+    statsStop(r->int_no, start);
+
+    /* Possibly switch to another thread, the stub resumes whichever frame we return */
+    return threadIrqExit(r);
+}
+
+void interruptStats(uint8_t vector, InterruptStats *out) {
+    *out = stats[vector];
+}
+
+void interruptStatsReset() {
+    uint32_t flags = irqSave();
+    memset((char *)stats, 0, sizeof(stats));
+    irqRestore(flags);
+}
+
+void interruptStatsDump() {
+    uint64_t totalNs = 0;
+    for (int vector = 0; vector < 256; vector++) {
+        InterruptStats *entry = &stats[vector];
+        if (entry->count == 0)
+            continue;
+        uint64_t ns = cyclesToNanoseconds(entry->cycles);
+        totalNs += ns;
+        serialPrintf("vector %3d: %u times, total %u us, avg %u ns, max %u ns\n", vector, entry->count,
+                     (uint32_t)udiv64(ns, 1000, NULL), (uint32_t)udiv64(ns, entry->count, NULL),
+                     (uint32_t)cyclesToNanoseconds(entry->maxCycles));
     }
-}
\ No newline at end of file
+
+    uint32_t uptimeUs = (uint32_t)udiv64(getNanosecondsSinceBoot(), 1000, NULL);
+    if (uptimeUs) {
+        // ns per us is per mille
+        serialPrintf("Handlers used %u per mille of the CPU\n", (uint32_t)udiv64(totalNs, uptimeUs, NULL));
+    }
+}
@@ -54,6 +54,11 @@ extern void irq13();
 extern void irq14();
 extern void irq15();
 
+extern void isr48();
+extern void isr49();
+extern void isr50();
+extern void isr_spurious();
+
 #define IRQ0 32
 #define IRQ1 33
 #define IRQ2 34
@@ -71,6 +76,9 @@ extern void irq15();
 #define IRQ14 46
 #define IRQ15 47
 
+/* Software interrupt used by threads to give up the CPU */
+#define ISR_YIELD 48
+
 /* Struct which aggregates many registers */
 typedef struct {
    uint32_t ds; /* Data segment selector */
@@ -80,9 +88,31 @@ typedef struct {
 } registers_t;
 
 void isr_install();
-void isr_handler(registers_t r);
+void isr_handler(registers_t *r);
+registers_t *irq_handler(registers_t *r);
 void irq_install();
 
+/* True while an IRQ handler (or a timer callback run by one) is executing */
+bool inInterrupt();
+
+/* State of the code an IRQ handler running on this CPU interrupted, NULL outside of IRQs */
+registers_t *interruptFrame();
+
 typedef void (*isr_t)(registers_t*);
 void register_interrupt_handler(uint8_t n, isr_t handler);
+
+/* Per-vector statistics, kept for every interrupt and exception. Cycles are
+ * measured with the TSC once init_timer has calibrated it, from the C entry
+ * point to the end of the handler, EOI included */
+typedef struct {
+    uint32_t count;
+    uint32_t maxCycles;     // Longest single run
+    uint64_t cycles;        // Over all runs
+} InterruptStats;
+
+void interruptStats(uint8_t vector, InterruptStats *stats);
+void interruptStatsReset();
+
+/* One line over serial per vector taken, and the share of time spent in handlers */
+void interruptStatsDump();
 #endif
\ No newline at end of file
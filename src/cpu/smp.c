@@ -0,0 +1,151 @@
+#include "smp.h"
+
+#include "idt.h"
+#include "isr.h"
+#include "fpu.h"
+#include "timer.h"
+#include "utils.h"
+#include "../libc/mem.h"
+#include "../libc/printf.h"
+
+// In trampoline.asm, fields are patched in the copy at SMP_TRAMPOLINE
+extern char smp_trampoline_start[];
+extern char smp_trampoline_end[];
+extern char smp_trampoline_stack[];
+extern char smp_trampoline_entry[];
+extern char smp_trampoline_cpu[];
+
+#define AP_STARTUP_WAIT_US 1000
+#define AP_ONLINE_WAIT_US  100000
+
+static Cpu cpus[SMP_MAX_CPUS];
+static uint32_t cpuCount = 1;
+
+static uint32_t *trampolineField(char *label) {
+    return (uint32_t *)(SMP_TRAMPOLINE + (label - smp_trampoline_start));
+}
+
+static void delayMicroseconds(uint32_t us) {
+    uint64_t end = getNanosecondsSinceBoot() + (uint64_t)us * 1000;
+    while (getNanosecondsSinceBoot() < end) {}
+}
+
+static void waitOnline(Cpu *cpu, uint32_t us) {
+    uint64_t end = getNanosecondsSinceBoot() + (uint64_t)us * 1000;
+    while (!cpu->online && getNanosecondsSinceBoot() < end) {}
+}
+
+static void callInterrupt(registers_t *r) {
+    // Only ends the hlt, apLoop picks the call up with interrupts enabled
+}
+
+static void apLoop(Cpu *cpu) {
+    while (true) {
+        __asm__ __volatile__("cli" : : : "memory");
+        SmpFunction function = cpu->callFunction;
+        if (function == NULL) {
+            // sti only takes effect after hlt, so an IPI sent after the check still wakes us
+            __asm__ __volatile__("sti; hlt" : : : "memory");
+            continue;
+        }
+        void *arg = cpu->callArg;
+        cpu->callFunction = NULL;
+        __asm__ __volatile__("sti" : : : "memory");
+        function(arg);
+    }
+}
+
+// Called by the trampoline on the AP's own stack
+static void apEntry(Cpu *cpu) {
+    gdtLoad(cpu->gdt, cpu, sizeof(Cpu));
+    set_idt();
+    init_fpu();
+    apicInitLocal();
+    cpu->online = true;
+    apLoop(cpu);
+}
+
+static bool startAp(uint8_t apicId) {
+    Cpu *cpu = &cpus[cpuCount];
+    cpu->self = cpu;
+    cpu->index = cpuCount;
+    cpu->apicId = apicId;
+    cpu->online = false;
+    spinInit(&cpu->callLock);
+    cpu->stack = malloc(SMP_AP_STACK_SIZE);
+
+    *trampolineField(smp_trampoline_stack) = ((uint32_t)cpu->stack + SMP_AP_STACK_SIZE) & ~15;
+    *trampolineField(smp_trampoline_entry) = (uint32_t)apEntry;
+    *trampolineField(smp_trampoline_cpu) = (uint32_t)cpu;
+
+    apicSendInit(apicId);
+    delayMicroseconds(10000);
+    apicSendStartup(apicId, SMP_TRAMPOLINE >> 12);
+    waitOnline(cpu, AP_STARTUP_WAIT_US);
+    if (!cpu->online) {
+        apicSendStartup(apicId, SMP_TRAMPOLINE >> 12);
+        waitOnline(cpu, AP_ONLINE_WAIT_US);
+    }
+
+    if (!cpu->online) {
+        free(cpu->stack);
+        return false;
+    }
+    cpuCount++;
+    return true;
+}
+
+void smpInitBoot() {
+    Cpu *cpu = &cpus[0];
+    cpu->self = cpu;
+    cpu->index = 0;
+    cpu->online = true;
+    spinInit(&cpu->callLock);
+    gdtLoad(cpu->gdt, cpu, sizeof(Cpu));
+}
+
+void smpInit() {
+    if (!apicEnabled())
+        return;
+    cpus[0].apicId = apicId();
+    register_interrupt_handler(SMP_CALL_VECTOR, callInterrupt);
+    memcpy(smp_trampoline_start, (char *)SMP_TRAMPOLINE, smp_trampoline_end - smp_trampoline_start);
+
+    // One at a time, they all start from the same trampoline fields
+    for (uint32_t i = 0; i < apicCpuCount() && cpuCount < SMP_MAX_CPUS; i++) {
+        uint8_t id = apicCpuId(i);
+        if (id == cpus[0].apicId)
+            continue;
+        if (!startAp(id)) {
+            serialPrintf("CPU with APIC ID %u didn't start\n", id);
+        }
+    }
+
+    serialPrintf("%u CPUs online\n", cpuCount);
+}
+
+uint32_t smpCpuCount() {
+    return cpuCount;
+}
+
+Cpu *smpCpu(uint32_t index) {
+    return index < cpuCount ? &cpus[index] : NULL;
+}
+
+bool smpCall(uint32_t index, SmpFunction function, void *arg) {
+    if (index == 0 || index >= cpuCount)
+        return false;
+    Cpu *cpu = &cpus[index];
+    spinLock(&cpu->callLock);
+    while (cpu->callFunction)
+        __asm__ __volatile__("rep; nop");
+    cpu->callArg = arg;
+    cpu->callFunction = function;
+    spinUnlock(&cpu->callLock);
+    smpSendIPI(index, SMP_CALL_VECTOR);
+    return true;
+}
+
+void smpSendIPI(uint32_t index, uint8_t vector) {
+    apicSendIPI(cpus[index].apicId, vector);
+}
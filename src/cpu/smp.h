@@ -0,0 +1,68 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "../types.h"
+#include "gdt.h"
+#include "apic.h"
+#include "spinlock.h"
+
+/* Multiprocessor support. The boot CPU brings the others (application
+ * processors, APs) up with INIT-SIPI-SIPI through a real mode trampoline. Each
+ * CPU has a Cpu area, reachable through GS, and its own GDT and stack.
+ *
+ * Threads, tasks and timers stay on the boot CPU. The APs run functions handed
+ * to them with smpCall, with interrupts enabled, and halt in between. */
+
+#define SMP_MAX_CPUS       APIC_MAX_CPUS
+#define SMP_CALL_VECTOR    50
+#define SMP_TRAMPOLINE     0x70000  // Page aligned and below 1 MiB, the SIPI vector is its page number
+#define SMP_AP_STACK_SIZE  16384
+
+typedef void (*SmpFunction)(void *arg);
+
+typedef struct Cpu {
+    struct Cpu *self;           // At GS:0, so cpuCurrent is a single load
+    uint32_t index;             // 0 for the boot CPU
+    uint8_t apicId;
+    volatile bool online;
+    uint32_t irqDepth;          // Nesting of IRQ handlers running on this CPU
+    void *stack;
+
+    // Mailbox for smpCall, the function is cleared once the CPU has picked it up
+    Spinlock callLock;
+    volatile SmpFunction callFunction;
+    void *volatile callArg;
+
+    GdtEntry gdt[GDT_ENTRIES];
+} Cpu;
+
+static inline Cpu *cpuCurrent() {
+    Cpu *cpu;
+    __asm__ __volatile__("movl %%gs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+static inline bool cpuIsBoot() {
+    return cpuCurrent()->index == 0;
+}
+
+/* Load the boot CPU's GDT and per-CPU area. Must run before anything else in main */
+void smpInitBoot();
+
+/* Start every other CPU the MADT lists. Needs the APICs and the timer */
+void smpInit();
+
+/* CPUs that are up, including the boot CPU */
+uint32_t smpCpuCount();
+
+Cpu *smpCpu(uint32_t index);
+
+/* Run `function(arg)` on CPU `index` (not the boot CPU) and return without
+ * waiting for it. Waits while the CPU still has an earlier call queued. Returns
+ * false if there is no such CPU */
+bool smpCall(uint32_t index, SmpFunction function, void *arg);
+
+/* Send interrupt `vector` to CPU `index` */
+void smpSendIPI(uint32_t index, uint8_t vector);
+
+#endif // SMP_H
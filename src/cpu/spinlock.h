@@ -0,0 +1,44 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../types.h"
+#include "utils.h"
+
+/* Busy-waiting lock for data shared between CPUs. Hold it briefly and never
+ * sleep or yield while holding it. Use the IrqSave variants for data that
+ * interrupt handlers touch too, or a handler on the same CPU could spin forever */
+
+typedef struct {
+    volatile uint32_t locked;
+} Spinlock;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spinInit(Spinlock *lock) {
+    lock->locked = 0;
+}
+
+static inline void spinLock(Spinlock *lock) {
+    // xchg is atomic and a full barrier, and spinning on plain reads keeps the cache line shared
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        while (lock->locked)
+            __asm__ __volatile__("rep; nop"); // pause
+    }
+}
+
+static inline void spinUnlock(Spinlock *lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+static inline uint32_t spinLockIrqSave(Spinlock *lock) {
+    uint32_t flags = irqSave();
+    spinLock(lock);
+    return flags;
+}
+
+static inline void spinUnlockIrqRestore(Spinlock *lock, uint32_t flags) {
+    spinUnlock(lock);
+    irqRestore(flags);
+}
+
+#endif // SPINLOCK_H
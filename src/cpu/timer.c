@@ -1,25 +1,414 @@
 #include "timer.h"
 #include "../libc/mem.h"
 #include "isr.h"
+#include "utils.h"
+#include "apic.h"
+#include "../drivers/ports.h"
+#include "../libc/printf.h"
+#include "../kernel/thread.h"
 
-uint64_t tick = 0;
+#define PIT_FREQUENCY 1193182   // Input clock of the PIT in Hz
+#define PIT_CHANNEL0  0x40
+#define PIT_COMMAND   0x43
+#define PIT_ONE_SHOT  0x30      // Channel 0, low then high byte, mode 0 (interrupt on terminal count)
+#define PIT_READ_BACK 0xC2      // Latch status and count of channel 0
+#define PIT_STATUS_OUT       0x80
+#define PIT_STATUS_NULLCOUNT 0x40
+#define PIT_MAX_COUNT 0xFFFF
 
-static void timer_callback(registers_t regs) {
-    tick++;
+#define PIT_CHANNEL2        0x42
+#define PIT_CHANNEL2_ONE_SHOT 0xB0  // Channel 2, low then high byte, mode 0
+#define PIT_CHANNEL2_GATE   0x61    // Bit 0 gates channel 2, bit 1 drives the speaker, bit 5 reads its output
+#define PIT_CHANNEL2_OUT    0x20
+
+#define TSC_CALIBRATION_MS 20
+#define CPUID_FEAT_EDX_TSC (1 << 4)
+
+#define WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static uint32_t frequency = 0;
+
+// With a TSC and a local APIC, the clock comes from the TSC and the LAPIC timer
+// raises the interrupts. Otherwise the PIT does both
+static bool lapicTimer = false;
+static uint32_t lapicKHz = 0;
+static uint32_t nsPerTick = 0;
+
+// The clock: ticks since boot, plus the part of a tick counted so far in
+// units of 1/(PIT_FREQUENCY * frequency) seconds
+static uint64_t tick = 0;
+static uint32_t tickRemainder = 0;
+
+// The one-shot count currently loaded, how much of it is already in the clock,
+// and the tick we expect it to fire at
+static uint32_t programmedCount = 0;
+static uint32_t consumedCount = 0;
+static uint64_t programmedTick = 0;
+
+// cycles * tscMultiplier >> tscShift is nanoseconds
+static uint32_t tscKHz = 0;
+static uint32_t tscMultiplier = 0;
+static uint32_t tscShift = 0;
+static uint64_t tscBase = 0;
+
+static Timer *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t wheelTick = 0;      // Next tick whose level 0 slot hasn't run yet
+static uint32_t pendingTimers = 0;
+
+// PIT counts elapsed since the one-shot count was loaded
+static uint32_t pitElapsed() {
+    portByteOut(PIT_COMMAND, PIT_READ_BACK);
+    uint8_t status = portByteIn(PIT_CHANNEL0);
+    uint32_t count = portByteIn(PIT_CHANNEL0);
+    count |= (uint32_t)portByteIn(PIT_CHANNEL0) << 8;
+
+    if (status & PIT_STATUS_NULLCOUNT)
+        return 0;   // The new count isn't loaded yet
+    if (status & PIT_STATUS_OUT)
+        return programmedCount + ((0x10000 - count) & 0xFFFF);  // Expired, counting on from 0xFFFF
+    return programmedCount - count;
+}
+
+static uint64_t tscNanoseconds() {
+    return cyclesToNanoseconds(readTSC() - tscBase);
+}
+
+// Bring the clock up to date. Must be called with interrupts disabled
+static void clockAdvance() {
+    if (lapicTimer) {
+        tick = udiv64(tscNanoseconds(), nsPerTick, NULL);
+        return;
+    }
+    if (frequency == 0 || programmedCount == 0)
+        return;
+    uint32_t elapsed = pitElapsed();
+    if (elapsed < consumedCount)
+        return;
+    // At most two full counts, so this stays well within 32 bits for any sane frequency
+    tickRemainder += (elapsed - consumedCount) * frequency;
+    consumedCount = elapsed;
+    tick += tickRemainder / PIT_FREQUENCY;
+    tickRemainder %= PIT_FREQUENCY;
+}
+
+static void pitOneShot(uint32_t count) {
+    clockAdvance();
+    portByteOut(PIT_COMMAND, PIT_ONE_SHOT);
+    portByteOut(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    portByteOut(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+    programmedCount = count;
+    consumedCount = 0;
+}
+
+static void wheelInsert(Timer *timer) {
+    uint64_t expires = timer->expires;
+    if (expires < wheelTick)
+        expires = wheelTick;    // Overdue, runs with the next slot
+    uint64_t delta = expires - wheelTick;
+    if (delta >= WHEEL_SPAN)
+        expires = wheelTick + WHEEL_SPAN - 1;   // Sorted down again as the wheel turns
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+    Timer **slot = &wheel[level][(uint32_t)(expires >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK];
+
+    timer->next = *slot;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+    pendingTimers++;
+}
+
+static void wheelRemove(Timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    pendingTimers--;
+}
+
+// Move the timers of a slot on `level` down to where they belong now, returns the slot index
+static uint32_t cascade(int level) {
+    uint32_t index = (uint32_t)(wheelTick >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+    Timer *timer = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (timer) {
+        Timer *next = timer->next;
+        pendingTimers--;
+        wheelInsert(timer);
+        timer = next;
+    }
+    return index;
+}
+
+// Run every timer due up to the current tick
+static void wheelRun() {
+    if (pendingTimers == 0 && wheelTick <= tick)
+        wheelTick = tick + 1;   // Nothing to run, and slots are placed by absolute tick
+    while (wheelTick <= tick) {
+        uint32_t index = (uint32_t)wheelTick & WHEEL_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+                if (cascade(level) != 0)
+                    break;
+        }
+
+        // Detach the slot so callbacks can start and cancel timers while we go through it
+        Timer *due = wheel[0][index];
+        wheel[0][index] = NULL;
+        if (due)
+            due->pprev = &due;
+        wheelTick++;
+
+        while (due) {
+            Timer *timer = due;
+            wheelRemove(timer);
+            timer->callback(timer->arg);
+        }
+    }
+}
+
+// The first tick anything may be due at: the next occupied level 0 slot, or the
+// next time the level above has to be sorted down, whichever comes first
+static uint64_t wheelNextDeadline() {
+    for (uint64_t t = wheelTick; ; t++) {
+        if (wheel[0][(uint32_t)t & WHEEL_MASK])
+            return t;
+        if (t != wheelTick && ((uint32_t)t & WHEEL_MASK) == 0)
+            return t;
+    }
+}
+
+// The LAPIC timer counts far enough that an idle CPU isn't woken at all
+static void programLapic() {
+    if (pendingTimers == 0) {
+        apicTimerOneShot(0);
+        programmedTick = ~0ULL;
+        return;
+    }
+    uint64_t deadline = wheelNextDeadline();
+    uint64_t at = deadline * nsPerTick;
+    uint64_t now = tscNanoseconds();
+    uint64_t count = 1;
+    if (at > now)
+        count = udiv64((at - now) * lapicKHz, 1000000, NULL) + 1;
+    if (count > 0xFFFFFFFFULL)
+        count = 0xFFFFFFFFULL;
+    apicTimerOneShot((uint32_t)count);
+    programmedTick = deadline;
+}
+
+// Load the PIT for the next deadline, or as long as it goes when nothing is pending
+static void programNext() {
+    if (frequency == 0)
+        return;
+    if (lapicTimer) {
+        programLapic();
+        return;
+    }
+    clockAdvance();
+
+    // The PIT can't count further than this, so the clock still needs the odd interrupt
+    uint32_t maxTicks = PIT_MAX_COUNT * frequency / PIT_FREQUENCY;
+    uint32_t ticks = maxTicks;
+    if (pendingTimers) {
+        uint64_t deadline = wheelNextDeadline();
+        if (deadline <= tick)
+            ticks = 0;
+        else if (deadline - tick < maxTicks)
+            ticks = (uint32_t)(deadline - tick);
+    }
+
+    uint32_t count;
+    if (ticks == 0) {
+        count = 1;
+    } else {
+        // Counts until the clock crosses into the deadline tick, rounded up
+        uint32_t needed = ticks * PIT_FREQUENCY - tickRemainder;
+        count = needed / frequency + (needed % frequency != 0);
+        if (count > PIT_MAX_COUNT)
+            count = PIT_MAX_COUNT;
+    }
+    pitOneShot(count);
+    programmedTick = tick + ticks;
+}
+
+static void timer_callback(registers_t *regs) {
+    clockAdvance();
+    wheelRun();
+    programNext();
 }
 
-uint64_t getTicksSinceBoot() { return tick; }
+uint64_t getTicksSinceBoot() {
+    uint32_t flags = irqSave();
+    clockAdvance();
+    uint64_t now = tick;
+    irqRestore(flags);
+    return now;
+}
+
+uint32_t getTimerFrequency() { return frequency; }
+
+uint32_t msToTicks(uint32_t ms) {
+    // Split to stay within 32 bits, there's no 64-bit division without libgcc
+    uint32_t ticks = (ms / 1000) * frequency + ((ms % 1000) * frequency + 999) / 1000;
+    return ticks ? ticks : 1;
+}
+
+void timerInit(Timer *timer, TimerCallback callback, void *arg) {
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void timerStartAt(Timer *timer, uint64_t when) {
+    uint32_t flags = irqSave();
+    if (timer->pprev)
+        wheelRemove(timer);
+    if (pendingTimers == 0) {
+        // The wheel stood still while it was empty, catch up here rather than
+        // slot by slot in the next interrupt, the same as wheelRun does
+        clockAdvance();
+        wheelTick = tick + 1;
+    }
+    timer->expires = when;
+    wheelInsert(timer);
+    // Only an earlier deadline than the loaded one needs the PIT reloaded
+    if (when < programmedTick)
+        programNext();
+    irqRestore(flags);
+}
+
+void timerStart(Timer *timer, uint32_t ms) {
+    timerStartAt(timer, getTicksSinceBoot() + msToTicks(ms));
+}
+
+void timerCancel(Timer *timer) {
+    uint32_t flags = irqSave();
+    if (timer->pprev)
+        wheelRemove(timer);
+    irqRestore(flags);
+}
+
+bool timerPending(Timer *timer) {
+    return timer->pprev != NULL;
+}
+
+static void wakeHalted(void *arg) {
+    // Nothing to do, the interrupt itself ends the hlt in timerSleep
+}
+
+void timerSleep(uint32_t ms) {
+    if (threadCurrent()) {
+        threadSleep(ms);
+        return;
+    }
+    Timer timer;
+    timerInit(&timer, wakeHalted, NULL);
+    timerStart(&timer, ms);
+    while (timerPending(&timer))
+        halt();
+}
+
+// Count TSC cycles and LAPIC timer counts while PIT channel 2 runs down a known
+// count. Channel 0 keeps the one-shot clock, so this doesn't disturb it
+static void calibrate() {
+    uint32_t edx = 0;
+    if (hasCPUID())
+        cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_FEAT_EDX_TSC))
+        return;
+
+    uint32_t count = PIT_FREQUENCY / 1000 * TSC_CALIBRATION_MS;
+    uint8_t gate = portByteIn(PIT_CHANNEL2_GATE);
+    portByteOut(PIT_CHANNEL2_GATE, (gate & ~0x02) | 0x01);   // Speaker off, gate on
+    portByteOut(PIT_COMMAND, PIT_CHANNEL2_ONE_SHOT);
+    portByteOut(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    portByteOut(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
+
+    if (apicEnabled())
+        apicTimerOneShot(0xFFFFFFFF);
+    uint64_t start = readTSC();
+    while (!(portByteIn(PIT_CHANNEL2_GATE) & PIT_CHANNEL2_OUT)) {}
+    uint64_t cycles = readTSC() - start;
+    uint32_t lapicCounts = apicEnabled() ? 0xFFFFFFFF - apicTimerCurrent() : 0;
+    portByteOut(PIT_CHANNEL2_GATE, gate);
+
+    if (apicEnabled()) {
+        apicTimerOneShot(0);
+        lapicKHz = (uint32_t)udiv64((uint64_t)lapicCounts * PIT_FREQUENCY, count * 1000, NULL);
+    }
+
+    tscKHz = (uint32_t)udiv64(cycles * PIT_FREQUENCY, count * 1000, NULL);
+    if (tscKHz == 0)
+        return;
+
+    // The most precise multiplier that still fits in 32 bits
+    tscShift = 32;
+    uint64_t multiplier;
+    while ((multiplier = udiv64(1000000ULL << tscShift, tscKHz, NULL)) > 0xFFFFFFFFULL)
+        tscShift--;
+    tscMultiplier = (uint32_t)multiplier;
+    tscBase = readTSC();
+}
+
+uint32_t getTSCFrequencyKHz() { return tscKHz; }
+
+uint64_t cyclesToNanoseconds(uint64_t cycles) {
+    // A 64 by 32 bit product, taken in halves to keep the 96-bit intermediate
+    uint64_t low = (uint64_t)(uint32_t)cycles * tscMultiplier;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * tscMultiplier;
+    return (high << (32 - tscShift)) + (low >> tscShift);
+}
+
+uint64_t getNanosecondsSinceBoot() {
+    if (tscKHz)
+        return cyclesToNanoseconds(readTSC() - tscBase);
+    if (frequency == 0)
+        return 0;
+    return getTicksSinceBoot() * (1000000000 / frequency);
+}
+
+void cycleAccumulatorReset(CycleAccumulator *accumulator) {
+    accumulator->count = 0;
+    accumulator->total = 0;
+    accumulator->max = 0;
+}
+
+void cycleAccumulatorDump(CycleAccumulator *accumulator) {
+    uint64_t totalNs = cyclesToNanoseconds(accumulator->total);
+    uint64_t averageNs = accumulator->count ? udiv64(totalNs, accumulator->count, NULL) : 0;
+
+    serialPrintf("%s: %u calls, total %u us, avg %u ns, max %u ns\n", accumulator->name, accumulator->count,
+                 (uint32_t)udiv64(totalNs, 1000, NULL), (uint32_t)averageNs,
+                 (uint32_t)cyclesToNanoseconds(accumulator->max));
+}
 
 void init_timer(uint32_t freq) {
-    /* Install the function we just wrote */
-    register_interrupt_handler(IRQ0, timer_callback);
-
-    /* Get the PIT value: hardware clock at 1193180 Hz */
-    uint32_t divisor = 1193180 / freq;
-    uint8_t low  = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)( (divisor >> 8) & 0xFF);
-    /* Send the command */
-    portByteOut(0x43, 0x36); /* Command port */
-    portByteOut(0x40, low);
-    portByteOut(0x40, high);
-}
\ No newline at end of file
+    uint32_t flags = irqSave();
+    calibrate();
+    frequency = freq;
+    nsPerTick = 1000000000 / freq;
+    wheelTick = tick;
+
+    lapicTimer = tscKHz && lapicKHz;
+    if (lapicTimer) {
+        register_interrupt_handler(APIC_TIMER_VECTOR, timer_callback);
+        apicMaskIrq(0, true);   // The PIT isn't needed anymore
+    } else {
+        /* Install the function we just wrote */
+        register_interrupt_handler(IRQ0, timer_callback);
+    }
+
+    /* Counting starts from here, the first one-shot covers whatever was started before */
+    programmedCount = 0;
+    consumedCount = 0;
+    programNext();
+    irqRestore(flags);
+}
@@ -3,8 +3,135 @@
 
 #include  "../types.h"
 
+/* The timer interrupt is one-shot and only programmed for the next pending
+ * timer, so an idle CPU isn't interrupted at a fixed rate. With a local APIC and
+ * a TSC the LAPIC timer raises it and the TSC keeps the time, otherwise the PIT
+ * does both. Time is kept in ticks of 1/freq seconds as passed to init_timer.
+ *
+ * Pending timers live in a hierarchical timer wheel: TIMER_WHEEL_LEVELS levels
+ * of TIMER_WHEEL_SLOTS slots, each level 64 times coarser than the one below,
+ * covering 2^24 ticks before timers are re-sorted on the way down. */
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef void (*TimerCallback)(void *arg);
+
+typedef struct Timer {
+    uint64_t expires;       // Tick the callback is due at
+    TimerCallback callback; // Runs in the timer interrupt, with interrupts disabled, keep it to a wakeup
+    void *arg;
+
+    struct Timer *next;     // Link in a wheel slot
+    struct Timer **pprev;   // Whatever points at us, NULL while not pending
+} Timer;
+
 void init_timer(uint32_t freq);
 
 uint64_t getTicksSinceBoot();
 
-#endif
\ No newline at end of file
+/* Ticks per second, as passed to init_timer */
+uint32_t getTimerFrequency();
+
+/* Number of ticks covering at least `ms` milliseconds, never 0 */
+uint32_t msToTicks(uint32_t ms);
+
+void timerInit(Timer *timer, TimerCallback callback, void *arg);
+
+/* Run the callback once, at least `ms` milliseconds from now. Restarts a pending timer.
+ * Safe to call from IRQs and timer callbacks */
+void timerStart(Timer *timer, uint32_t ms);
+
+/* Run the callback once the clock reaches `tick`, or on the next interrupt if it already has */
+void timerStartAt(Timer *timer, uint64_t tick);
+
+/* Stop a pending timer, does nothing if it isn't pending */
+void timerCancel(Timer *timer);
+
+bool timerPending(Timer *timer);
+
+/* Wait at least `ms` milliseconds, sleeping the calling thread once threads are running */
+void timerSleep(uint32_t ms);
+
+/* High resolution time. init_timer calibrates the TSC against the PIT, the
+ * nanosecond clock counts from that moment. Without a TSC the nanosecond clock
+ * falls back to the tick clock, the cycle counters need one */
+
+typedef struct {
+    char *name;
+    uint32_t count;     // Intervals added
+    uint64_t total;     // Cycles over all of them
+    uint64_t max;       // Cycles of the longest one
+    uint64_t started;   // Set by cycleAccumulatorStart
+} CycleAccumulator;
+
+#define CYCLE_ACCUMULATOR(name) { (name), 0, 0, 0, 0 }
+
+typedef struct {
+    CycleAccumulator *accumulator;
+    uint64_t start;
+} CycleScope;
+
+static inline uint64_t readTSC() {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* TSC rate measured at boot, 0 if the CPU has no TSC */
+uint32_t getTSCFrequencyKHz();
+
+uint64_t cyclesToNanoseconds(uint64_t cycles);
+
+/* Monotonic time since the timer was initialized */
+uint64_t getNanosecondsSinceBoot();
+
+/* Count the cycles of an interval: `start = cyclesStart(); ... cyclesStop(start)` */
+static inline uint64_t cyclesStart() {
+    return readTSC();
+}
+
+static inline uint64_t cyclesStop(uint64_t start) {
+    return readTSC() - start;
+}
+
+/* Add an interval to an accumulator. Accumulators aren't locked, give every
+ * thread or handler its own */
+static inline void cycleAccumulatorAdd(CycleAccumulator *accumulator, uint64_t cycles) {
+    accumulator->count++;
+    accumulator->total += cycles;
+    if (cycles > accumulator->max)
+        accumulator->max = cycles;
+}
+
+static inline void cycleAccumulatorStart(CycleAccumulator *accumulator) {
+    accumulator->started = readTSC();
+}
+
+static inline void cycleAccumulatorStop(CycleAccumulator *accumulator) {
+    cycleAccumulatorAdd(accumulator, readTSC() - accumulator->started);
+}
+
+void cycleAccumulatorReset(CycleAccumulator *accumulator);
+
+/* One line over serial: calls, total, average and maximum time */
+void cycleAccumulatorDump(CycleAccumulator *accumulator);
+
+static inline CycleScope cycleScopeBegin(CycleAccumulator *accumulator) {
+    CycleScope scope = { accumulator, readTSC() };
+    return scope;
+}
+
+static inline void cycleScopeEnd(CycleScope *scope) {
+    cycleAccumulatorAdd(scope->accumulator, readTSC() - scope->start);
+}
+
+#define CYCLE_SCOPE_NAME_(line) cycleScope##line
+#define CYCLE_SCOPE_NAME(line) CYCLE_SCOPE_NAME_(line)
+
+/* Charge the rest of the enclosing block, however it is left, to `accumulator` */
+#define CYCLE_SCOPE(accumulator) \
+    CycleScope CYCLE_SCOPE_NAME(__LINE__) __attribute__((cleanup(cycleScopeEnd))) = cycleScopeBegin(accumulator)
+
+#endif
@@ -0,0 +1,57 @@
+; Application processor startup code. smpInit copies it to SMP_TRAMPOLINE (0x70000)
+; and fills in the stack, entry and cpu fields, then a startup IPI starts the AP
+; here in real mode with cs = 0x7000, ip = 0.
+;
+; Everything is addressed relative to the copy, so the code doesn't care where
+; the kernel linked it.
+
+SMP_TRAMPOLINE equ 0x70000
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE + (label - smp_trampoline_start))
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_stack
+global smp_trampoline_entry
+global smp_trampoline_cpu
+
+[bits 16]
+smp_trampoline_start:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    lgdt [smp_trampoline_gdtr - smp_trampoline_start]
+    mov eax, cr0
+    or eax, 0x1
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE(smp_trampoline_pm)
+
+[bits 32]
+smp_trampoline_pm:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [TRAMPOLINE(smp_trampoline_stack)]
+    push dword [TRAMPOLINE(smp_trampoline_cpu)]
+    call [TRAMPOLINE(smp_trampoline_entry)]
+.hang:                      ; The entry never returns
+    cli
+    hlt
+    jmp .hang
+
+align 8
+smp_trampoline_gdt:         ; Flat code and data, until the AP loads its own GDT
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+smp_trampoline_gdtr:
+    dw 3 * 8 - 1
+    dd TRAMPOLINE(smp_trampoline_gdt)
+
+smp_trampoline_stack: dd 0  ; Top of the AP's stack
+smp_trampoline_entry: dd 0  ; void entry(Cpu *cpu)
+smp_trampoline_cpu:   dd 0
+smp_trampoline_end:
@@ -1,3 +1,42 @@
+#include "utils.h"
+
 void halt() {
     asm( "hlt" );
-}
\ No newline at end of file
+}
+
+bool hasCPUID() {
+    uint32_t before, after;
+    __asm__ __volatile__(
+        "pushfl\n\t"
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl $0x200000, %1\n\t" // flip the ID bit
+        "pushl %1\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %1\n\t"
+        "popfl"
+        : "=&r" (before), "=&r" (after));
+    return ((before ^ after) & 0x200000) != 0;
+}
+
+void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    uint32_t a, b, c, d;
+    __asm__ __volatile__("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (leaf), "c" (0));
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+uint64_t udiv64(uint64_t dividend, uint32_t divisor, uint32_t *remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t quotientHigh = high / divisor;
+    uint32_t quotientLow, rest = high % divisor;
+    // rest < divisor, so the second divide can't overflow
+    __asm__("divl %4" : "=a" (quotientLow), "=d" (rest) : "a" ((uint32_t)dividend), "d" (rest), "rm" (divisor));
+    if (remainder)
+        *remainder = rest;
+    return ((uint64_t)quotientHigh << 32) | quotientLow;
+}
@@ -1,6 +1,40 @@
 #ifndef CPU_UTILS_H
 #define CPU_UTILS_H
 
+#include "../types.h"
+
 void halt();
 
-#endif // CPU_UTILS_H
\ No newline at end of file
+/* Disable interrupts, returning the previous EFLAGS for irqRestore */
+static inline uint32_t irqSave() {
+    uint32_t flags;
+    __asm__ __volatile__("pushfl\n\tpopl %0\n\tcli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt flag saved by irqSave */
+static inline void irqRestore(uint32_t flags) {
+    __asm__ __volatile__("pushl %0\n\tpopfl" : : "r" (flags) : "memory", "cc");
+}
+
+/* Does the CPU support the `cpuid` instruction (EFLAGS.ID can be toggled) */
+bool hasCPUID();
+
+/* Execute `cpuid` for `leaf`, any output pointer may be NULL */
+void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx);
+
+/* Read and write model specific registers */
+static inline uint64_t readMSR(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void writeMSR(uint32_t msr, uint64_t value) {
+    __asm__ __volatile__("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+/* 64 by 32 bit division, gcc would call into libgcc for it. `remainder` may be NULL */
+uint64_t udiv64(uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+
+#endif // CPU_UTILS_H
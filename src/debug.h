@@ -1,22 +1,18 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-#include "debug.h"
+/* Which log statements are compiled in, see kernel/log.h. Override from the
+ * build, e.g. CFLAGS="-DLOG_LEVEL=LOG_LEVEL_DEBUG -DLOG_CATEGORIES=0x18".
+ * Logs are drained to COM1, build with -DLOG_VGA to have them on the screen instead */
 
-#define DEBUG
-#ifdef DEBUG
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
 
-#include "drivers/vga.h"
-#define LOG(message)  vgaWrite(message)
-#define LOG_INT(num)  vgaWriteInt(num)
-#define LOG_BYTE(num) vgaWriteByte(num)
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES LOG_CAT_ALL
+#endif
 
-#else
+#include "kernel/log.h"
 
-#define LOG(message)
-#define LOG_INT(num)
-#define LOG_BYTE(num)
-
-#endif  // DEBUG
-
-#endif  // DEBUG_H
\ No newline at end of file
+#endif  // DEBUG_H
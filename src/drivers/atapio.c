@@ -1,6 +1,7 @@
 #include "atapio.h"
 
 #include "../drivers/ports.h"
+#include "../kernel/thread.h"
 #include "../debug.h"
 
 // LBA value: the sector offset from the very beginning of the disk
@@ -27,12 +28,13 @@ static void waitStatusRead() {
 }
 
 void waitBSYClear() {
-    while (portByteIn(ATAPIO_Port_CommStat) & 0x80) {}  // wait until BSY clears
+    // wait until BSY clears, letting other threads run in the meantime
+    while (portByteIn(ATAPIO_Port_CommStat) & 0x80) {
+        threadYield();
+    }
 }
 
 bool atapioIdentify(uint8_t target, uint16_t *buffer) {
-    LOG("Identifying drive "); LOG_BYTE(target); LOG("... ");
-
     portByteOut(ATAPIO_Port_DriveSelect, target);
 
     waitStatusRead();
@@ -48,9 +50,8 @@ bool atapioIdentify(uint8_t target, uint16_t *buffer) {
 
     uint8_t status = portByteIn(ATAPIO_Port_CommStat);
     
-    LOG("[");LOG_BYTE(status);LOG("] ");
     if (status == 0) {
-        LOG("Not a drive, RIP (status was 0)\n");
+        LOG_WARN(LOG_CAT_DISK, "Drive %x: not a drive (status was 0)", target);
         return false; // not a drive
     }
     waitBSYClear();
@@ -59,7 +60,7 @@ bool atapioIdentify(uint8_t target, uint16_t *buffer) {
     uint8_t hi = portByteIn(ATAPIO_Port_LBAhi);
 
     if (mid || hi) {
-        LOG("Not ATA compliant :( (LBAmid or LBAhi was not 0)\n");
+        LOG_WARN(LOG_CAT_DISK, "Drive %x: not ATA compliant (LBAmid or LBAhi was not 0)", target);
         return false; // not ATA
     }
 
@@ -67,14 +68,14 @@ bool atapioIdentify(uint8_t target, uint16_t *buffer) {
     while ((portByteIn(ATAPIO_Port_CommStat) & 9) == 0) {} // wait until DRQ sets or ERR sets
     
     if ((portByteIn(ATAPIO_Port_CommStat) & 1) == 1) {
-        LOG("Disk error, F in chat (ERR bit was set)\n");
+        LOG_ERROR(LOG_CAT_DISK, "Drive %x: identify failed (ERR bit was set)", target);
         return false; // ERR was set
     }
 
     for (size_t i = 0; i < 256; i++) {
         buffer[i] = portWordIn(ATAPIO_Port_Data);
     }
-    LOG("All seems good :D\n");
+    LOG_INFO(LOG_CAT_DISK, "Drive %x identified, status %x", target, status);
     return true;
 }
 
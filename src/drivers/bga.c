@@ -0,0 +1,72 @@
+#include "bga.h"
+#include "pci.h"
+#include "ports.h"
+
+#define BGA_PORT_INDEX 0x01CE
+#define BGA_PORT_DATA  0x01CF
+
+#define BGA_INDEX_ID          0
+#define BGA_INDEX_XRES        1
+#define BGA_INDEX_YRES        2
+#define BGA_INDEX_BPP         3
+#define BGA_INDEX_ENABLE      4
+#define BGA_INDEX_VIRT_WIDTH  6
+
+#define BGA_ID_LFB            0xB0C2 // First version with 32 bpp and the linear framebuffer
+#define BGA_ID_LATEST         0xB0C5
+#define BGA_ENABLED           0x01
+#define BGA_LFB_ENABLED       0x40
+
+#define BGA_PCI_VENDOR        0x1234
+#define BGA_PCI_DEVICE        0x1111
+#define BGA_DEFAULT_LFB       0xE0000000 // Bochs' fixed address, when the adapter isn't on PCI
+
+static void writeRegister(uint16_t index, uint16_t value) {
+    portWordOut(BGA_PORT_INDEX, index);
+    portWordOut(BGA_PORT_DATA, value);
+}
+
+static uint16_t readRegister(uint16_t index) {
+    portWordOut(BGA_PORT_INDEX, index);
+    return portWordIn(BGA_PORT_DATA);
+}
+
+static uint32_t *findFramebuffer() {
+    PciAddress address;
+    if (pciFindDevice(BGA_PCI_VENDOR, BGA_PCI_DEVICE, &address))
+        return (uint32_t *)(pciConfigRead(&address, PCI_BAR0) & 0xFFFFFFF0);
+    return (uint32_t *)BGA_DEFAULT_LFB;
+}
+
+bool bgaAvailable() {
+    uint16_t id = readRegister(BGA_INDEX_ID);
+    return id >= BGA_ID_LFB && id <= BGA_ID_LATEST;
+}
+
+bool bgaSetMode(uint32_t width, uint32_t height, Framebuffer *framebuffer) {
+    if (!bgaAvailable())
+        return false;
+
+    writeRegister(BGA_INDEX_ENABLE, 0);
+    writeRegister(BGA_INDEX_XRES, (uint16_t)width);
+    writeRegister(BGA_INDEX_YRES, (uint16_t)height);
+    writeRegister(BGA_INDEX_BPP, 32);
+    writeRegister(BGA_INDEX_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED);
+
+    // The adapter clamps what it can't do, a mode it didn't take stays off
+    if (readRegister(BGA_INDEX_XRES) != width || readRegister(BGA_INDEX_YRES) != height ||
+        readRegister(BGA_INDEX_BPP) != 32) {
+        bgaDisable();
+        return false;
+    }
+
+    framebuffer->pixels = findFramebuffer();
+    framebuffer->width = width;
+    framebuffer->height = height;
+    framebuffer->pitch = readRegister(BGA_INDEX_VIRT_WIDTH);
+    return true;
+}
+
+void bgaDisable() {
+    writeRegister(BGA_INDEX_ENABLE, 0);
+}
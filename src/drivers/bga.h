@@ -0,0 +1,26 @@
+#ifndef BGA_H
+#define BGA_H
+
+#include "../types.h"
+
+/* Bochs Graphics Adapter, the VBE "DISPI" interface of QEMU's -vga std. Sets a
+ * linear framebuffer mode directly through its I/O ports, without the BIOS */
+
+typedef struct {
+    uint32_t *pixels;   // Linear framebuffer, 32 bits per pixel as 0x00RRGGBB
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;     // Pixels from one line to the next
+} Framebuffer;
+
+/* Is there a DISPI interface with 32 bpp and a linear framebuffer */
+bool bgaAvailable();
+
+/* Switch to `width` x `height` x 32 bpp. Returns false, staying in text mode,
+ * if the adapter doesn't take the mode */
+bool bgaSetMode(uint32_t width, uint32_t height, Framebuffer *framebuffer);
+
+/* Back to VGA text mode */
+void bgaDisable();
+
+#endif // BGA_H
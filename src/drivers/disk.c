@@ -2,12 +2,44 @@
 
 #include "atapio.h"
 
+#include "../cpu/timer.h"
+#include "../cpu/utils.h"
 #include "../debug.h"
+#include "../libc/mem.h"
+
+// Requests queued by diskSubmit, in submission order
+static DiskRequest *pendingHead = NULL;
+static DiskRequest *pendingTail = NULL;
+static Thread *diskThread = NULL;
+
+static DiskStats stats;
+static Spinlock statsLock = SPINLOCK_INIT;
+
+// Reads of one disk in the order they were made, without repeats, taken under its lock
+static DiskInfo *recording = NULL;
+static DiskExtent recorded[DISK_RECORD_MAX];
+static uint32_t recordedCount = 0;
+
+static void account(bool write, uint8_t count, uint64_t cycles) {
+    uint32_t flags = spinLockIrqSave(&statsLock);
+    if (write) {
+        stats.writes++;
+        stats.sectorsWritten += count;
+    } else {
+        stats.reads++;
+        stats.sectorsRead += count;
+    }
+    stats.cycles += cycles;
+    spinUnlockIrqRestore(&statsLock, flags);
+}
 
 bool diskGetATAPIO(byte id, DiskInfo *diskInfo) {
     diskInfo->backend = DISK_BACKEND_ATAPIO;
     diskInfo->_atapio_id = id;
     diskInfo->_atapio_rw28id = id? ATAPIO_ReadWrite28_Secondary : ATAPIO_ReadWrite28_Primary;
+    mutexInit(&diskInfo->lock);
+    diskInfo->_cache = NULL;
+    diskInfo->_cacheRuns = 0;
 
     uint16_t data[256];
     diskInfo->allOK = atapioIdentify(diskInfo->_atapio_rw28id, data);
@@ -17,33 +49,277 @@ bool diskGetATAPIO(byte id, DiskInfo *diskInfo) {
     return diskInfo->allOK;
 }
 
-bool diskRead(DiskInfo *diskInfo, uint32_t sector, uint8_t count, byte *buffer) {
-    if (!(diskInfo->allOK)) {
-        LOG("Cannot read from disk!\n");
-        return false;
-    }
+// The transfers themselves, called holding `lock`
+static void readSectors(DiskInfo *diskInfo, uint32_t sector, uint8_t count, byte *buffer) {
+    uint64_t start = cyclesStart();
     switch (diskInfo->backend)
     {
         case DISK_BACKEND_ATAPIO:
-            //LOG("Reading with ATAPIO backend\n");
-            uint32_t a = 0;
             atapioRead28(diskInfo->_atapio_rw28id, sector, count, buffer);
             break;
     }
-    return true;
+    uint64_t cycles = cyclesStop(start);
+    account(false, count, cycles);
 }
 
-bool diskWrite(DiskInfo *diskInfo, uint32_t sector, uint8_t count, const byte *buffer) {
-    if (!(diskInfo->allOK)) {
-        LOG("Cannot write to disk!\n");
-        return false;
-    }
+static void writeSectors(DiskInfo *diskInfo, uint32_t sector, uint8_t count, const byte *buffer) {
+    uint64_t start = cyclesStart();
     switch (diskInfo->backend)
     {
         case DISK_BACKEND_ATAPIO:
-            //LOG("Writing with ATAPIO backend\n");
             atapioWrite28(diskInfo->_atapio_rw28id, sector, count, buffer);
             break;
     }
+    uint64_t cycles = cyclesStop(start);
+    account(true, count, cycles);
+}
+
+// The cached run holding all of [sector, sector + count), if any
+static DiskCacheRun *cacheFind(DiskInfo *diskInfo, uint32_t sector, uint32_t count) {
+    for (uint32_t i = 0; i < diskInfo->_cacheRuns; i++) {
+        DiskCacheRun *run = &diskInfo->_cache[i];
+        if (sector >= run->sector && sector + count <= run->sector + run->count)
+            return run;
+    }
+    return NULL;
+}
+
+// Keep a copy of sectors just read, while there is room
+static void cacheInsert(DiskInfo *diskInfo, uint32_t sector, uint32_t count, const byte *buffer) {
+    if (diskInfo->_cacheRuns == DISK_CACHE_MAX_RUNS)
+        return;
+    DiskCacheRun *run = &diskInfo->_cache[diskInfo->_cacheRuns++];
+    run->sector = sector;
+    run->count = count;
+    run->data = (byte *)malloc(count * DISK_SECTOR_SIZE);
+    memcpy((char *)buffer, (char *)run->data, count * DISK_SECTOR_SIZE);
+}
+
+// Writes go to the disk and to every cached copy of the sectors
+static void cacheUpdate(DiskInfo *diskInfo, uint32_t sector, uint32_t count, const byte *buffer) {
+    for (uint32_t i = 0; i < diskInfo->_cacheRuns; i++) {
+        DiskCacheRun *run = &diskInfo->_cache[i];
+        uint32_t first = sector > run->sector ? sector : run->sector;
+        uint32_t end = sector + count < run->sector + run->count ? sector + count : run->sector + run->count;
+        if (first < end)
+            memcpy((char *)buffer + (first - sector) * DISK_SECTOR_SIZE,
+                   (char *)run->data + (first - run->sector) * DISK_SECTOR_SIZE, (end - first) * DISK_SECTOR_SIZE);
+    }
+}
+
+static void record(DiskInfo *diskInfo, uint32_t sector, uint32_t count) {
+    if (recording != diskInfo)
+        return;
+    // The filesystem reads the FAT and the root directory over and over
+    for (uint32_t i = 0; i < recordedCount; i++)
+        if (recorded[i].sector == sector && recorded[i].count == count)
+            return;
+    if (recordedCount == DISK_RECORD_MAX)
+        return;
+    recorded[recordedCount].sector = sector;
+    recorded[recordedCount].count = count;
+    recordedCount++;
+}
+
+bool diskRead(DiskInfo *diskInfo, uint32_t sector, uint8_t count, byte *buffer) {
+    if (!(diskInfo->allOK)) {
+        LOG_ERROR(LOG_CAT_DISK, "Cannot read from disk, sector %u", sector);
+        return false;
+    }
+    mutexLock(&diskInfo->lock);
+    record(diskInfo, sector, count);
+    DiskCacheRun *run = diskInfo->_cache ? cacheFind(diskInfo, sector, count) : NULL;
+    if (run) {
+        memcpy((char *)run->data + (sector - run->sector) * DISK_SECTOR_SIZE, (char *)buffer, count * DISK_SECTOR_SIZE);
+        uint32_t flags = spinLockIrqSave(&statsLock);
+        stats.cachedReads++;
+        spinUnlockIrqRestore(&statsLock, flags);
+    } else {
+        readSectors(diskInfo, sector, count, buffer);
+        if (diskInfo->_cache && count > 0)
+            cacheInsert(diskInfo, sector, count, buffer);
+    }
+    mutexUnlock(&diskInfo->lock);
+    return true;
+}
+
+bool diskWrite(DiskInfo *diskInfo, uint32_t sector, uint8_t count, const byte *buffer) {
+    if (!(diskInfo->allOK)) {
+        LOG_ERROR(LOG_CAT_DISK, "Cannot write to disk, sector %u", sector);
+        return false;
+    }
+    mutexLock(&diskInfo->lock);
+    writeSectors(diskInfo, sector, count, buffer);
+    if (diskInfo->_cache)
+        cacheUpdate(diskInfo, sector, count, buffer);
+    mutexUnlock(&diskInfo->lock);
     return true;
-}
\ No newline at end of file
+}
+
+void diskCacheStart(DiskInfo *diskInfo) {
+    mutexLock(&diskInfo->lock);
+    if (diskInfo->_cache == NULL)
+        diskInfo->_cache = (DiskCacheRun *)calloc(DISK_CACHE_MAX_RUNS, sizeof(DiskCacheRun));
+    mutexUnlock(&diskInfo->lock);
+}
+
+void diskCacheStop(DiskInfo *diskInfo) {
+    mutexLock(&diskInfo->lock);
+    if (diskInfo->_cache) {
+        for (uint32_t i = 0; i < diskInfo->_cacheRuns; i++)
+            free(diskInfo->_cache[i].data);
+        free(diskInfo->_cache);
+        diskInfo->_cache = NULL;
+        diskInfo->_cacheRuns = 0;
+    }
+    mutexUnlock(&diskInfo->lock);
+}
+
+// End of the cached run holding `sector`, 0 if none does
+static uint32_t cachedUntil(DiskInfo *diskInfo, uint32_t sector) {
+    DiskCacheRun *run = cacheFind(diskInfo, sector, 1);
+    return run ? run->sector + run->count : 0;
+}
+
+// Whether one of the extents has sectors on both sides of `sector`
+static bool splitsExtent(DiskExtent *extents, uint32_t count, uint32_t sector) {
+    for (uint32_t i = 0; i < count; i++)
+        if (extents[i].sector < sector && sector < extents[i].sector + extents[i].count)
+            return true;
+    return false;
+}
+
+/* Read whatever of [first, end) isn't cached yet into the cache, in chunks.
+ * cacheFind wants a read inside one run, so a chunk only ends in the middle of
+ * one of the run's `extents` where the cache or a transfer's size forces it */
+static uint32_t readAhead(DiskInfo *diskInfo, uint32_t first, uint32_t end,
+                          DiskExtent *extents, uint32_t count, byte *buffer) {
+    uint32_t reads = 0;
+    uint32_t sector = first;
+    while (sector < end && diskInfo->_cacheRuns < DISK_CACHE_MAX_RUNS) {
+        uint32_t cached = cachedUntil(diskInfo, sector);
+        if (cached) {
+            sector = cached;
+            continue;
+        }
+        uint32_t last = sector + 1;
+        uint32_t cut = 0;       // Furthest end so far that splits nothing
+        for (; last < end && last - sector < DISK_READAHEAD_MAX && !cachedUntil(diskInfo, last); last++) {
+            if (!splitsExtent(extents, count, last)) {
+                cut = last;
+                if (last - sector >= DISK_READAHEAD_CHUNK)
+                    break;
+            }
+        }
+        if (last == end || last - sector < DISK_READAHEAD_MAX || cut == 0)
+            cut = last;
+        last = cut;
+        readSectors(diskInfo, sector, (uint8_t)(last - sector), buffer);
+        cacheInsert(diskInfo, sector, last - sector, buffer);
+        reads++;
+        sector = last;
+    }
+    return reads;
+}
+
+void diskReadahead(DiskInfo *diskInfo, DiskExtent *extents, uint32_t count) {
+    if (!diskInfo->allOK || diskInfo->_cache == NULL || count == 0)
+        return;
+
+    // Insertion sort by sector, there are a few dozen of them
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t sector = extents[i].sector;
+        uint32_t sectors = extents[i].count;
+        uint32_t j = i;
+        for (; j > 0 && extents[j - 1].sector > sector; j--) {
+            extents[j].sector = extents[j - 1].sector;
+            extents[j].count = extents[j - 1].count;
+        }
+        extents[j].sector = sector;
+        extents[j].count = sectors;
+    }
+
+    byte *buffer = (byte *)malloc(DISK_READAHEAD_MAX * DISK_SECTOR_SIZE);
+    uint32_t reads = 0, runs = 0;
+    mutexLock(&diskInfo->lock);
+    uint32_t i = 0;
+    while (i < count) {
+        // Reading the gap between two close extents is cheaper than seeking over it
+        uint32_t start = i;
+        uint32_t first = extents[i].sector;
+        uint32_t end = first + extents[i].count;
+        for (i++; i < count && extents[i].sector <= end + DISK_READAHEAD_GAP; i++) {
+            if (extents[i].sector + extents[i].count > end)
+                end = extents[i].sector + extents[i].count;
+        }
+        reads += readAhead(diskInfo, first, end, &extents[start], i - start, buffer);
+        runs++;
+    }
+    mutexUnlock(&diskInfo->lock);
+    free(buffer);
+    LOG_INFO(LOG_CAT_DISK, "Readahead of %u extents: %u runs, %u reads", count, runs, reads);
+}
+
+void diskRecordStart(DiskInfo *diskInfo) {
+    mutexLock(&diskInfo->lock);
+    recordedCount = 0;
+    recording = diskInfo;
+    mutexUnlock(&diskInfo->lock);
+}
+
+uint32_t diskRecordStop(DiskExtent *extents, uint32_t max) {
+    DiskInfo *diskInfo = recording;
+    if (diskInfo == NULL)
+        return 0;
+    mutexLock(&diskInfo->lock);
+    recording = NULL;
+    uint32_t count = recordedCount < max ? recordedCount : max;
+    for (uint32_t i = 0; i < count; i++) {
+        extents[i].sector = recorded[i].sector;
+        extents[i].count = recorded[i].count;
+    }
+    mutexUnlock(&diskInfo->lock);
+    return count;
+}
+
+static void diskThreadLoop(void *arg) {
+    while (true) {
+        uint32_t flags = irqSave();
+        while (pendingHead == NULL)
+            threadBlock();
+        DiskRequest *request = pendingHead;
+        pendingHead = request->next;
+        if (pendingHead == NULL)
+            pendingTail = NULL;
+        irqRestore(flags);
+
+        if (request->write)
+            request->ok = diskWrite(request->disk, request->sector, request->count, request->buffer);
+        else
+            request->ok = diskRead(request->disk, request->sector, request->count, request->buffer);
+        taskSignal(&request->done);
+    }
+}
+
+void diskSubmit(DiskRequest *request) {
+    request->ok = false;
+    request->next = NULL;
+    taskEventInit(&request->done);
+
+    uint32_t flags = irqSave();
+    if (diskThread == NULL)
+        diskThread = threadCreate("disk", diskThreadLoop, NULL, THREAD_PRIORITY_HIGH);
+    if (pendingTail)
+        pendingTail->next = request;
+    else
+        pendingHead = request;
+    pendingTail = request;
+    threadWake(diskThread);
+    irqRestore(flags);
+}
+
+void diskGetStats(DiskStats *out) {
+    uint32_t flags = spinLockIrqSave(&statsLock);
+    *out = stats;
+    spinUnlockIrqRestore(&statsLock, flags);
+}
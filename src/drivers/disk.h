@@ -2,23 +2,101 @@
 #define DISK_H
 
 #include "../types.h"
+#include "../kernel/thread.h"
+#include "../kernel/task.h"
+#include "../cpu/spinlock.h"
 
 #define DISK_BACKEND_ATAPIO 0
 
+#define DISK_SECTOR_SIZE     512
+#define DISK_CACHE_MAX_RUNS  64     // Runs of sectors the cache keeps, later reads aren't cached
+#define DISK_RECORD_MAX      256    // Distinct reads the recorder keeps
+#define DISK_READAHEAD_GAP   16     // Sectors between two extents that are read too, to merge them
+#define DISK_READAHEAD_CHUNK 128    // Sectors per read of the readahead, more to finish an extent
+#define DISK_READAHEAD_MAX   255    // Sectors per read at most, the count is a byte
+
+/* Sectors held in memory by the cache */
+typedef struct {
+    uint32_t sector;
+    uint32_t count;
+    byte *data;
+} DiskCacheRun;
+
+/* A read, as recorded and replayed by the readahead */
+typedef struct {
+    uint32_t sector;
+    uint32_t count;
+} DiskExtent;
+
 typedef struct {
     bool allOK;
     byte backend;
     uint32_t sectors;   // Maximum disk capacity in sectors
+    Mutex lock;         // One command at a time on any CPU, held for the whole transfer
 
     // backend-specific fields, used internally
     byte _atapio_id;
     byte _atapio_rw28id;
+
+    // DISK_CACHE_MAX_RUNS runs between diskCacheStart and diskCacheStop, otherwise NULL
+    DiskCacheRun *_cache;
+    uint32_t _cacheRuns;
 } DiskInfo;
 
+/* An asynchronous read or write, carried out by the disk thread */
+typedef struct DiskRequest {
+    DiskInfo *disk;
+    uint32_t sector;
+    uint8_t count;
+    bool write;
+    byte *buffer;
+
+    bool ok;            // Result, valid once `done` is signalled
+    TaskEvent done;
+
+    struct DiskRequest *next;
+} DiskRequest;
+
+/* Transfers of every disk since boot */
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t sectorsRead;
+    uint32_t sectorsWritten;
+    uint64_t cycles;    // TSC cycles spent in transfers
+    uint32_t cachedReads;   // diskRead calls the cache answered, not counted in `reads`
+} DiskStats;
+
 bool diskGetATAPIO(byte id, DiskInfo *diskInfo);
 
 bool diskRead(DiskInfo *diskInfo, uint32_t sector, uint8_t count, byte *buffer);
 
 bool diskWrite(DiskInfo *diskInfo, uint32_t sector, uint8_t count, const byte *buffer);
 
+/* Queue a request and return at once, `request->done` is signalled when it has
+ * been carried out. The request must stay valid until then. Boot CPU only,
+ * unlike diskRead and diskWrite */
+void diskSubmit(DiskRequest *request);
+
+void diskGetStats(DiskStats *stats);
+
+/* Block cache for the boot. While it is on, every sector read is kept, reads
+ * that fall entirely in a kept run are answered from memory, and writes go to
+ * the disk and to the kept copies. Stopping it frees everything */
+void diskCacheStart(DiskInfo *diskInfo);
+void diskCacheStop(DiskInfo *diskInfo);
+
+/* Read the extents into the cache ahead of use: sorted in place, merged when
+ * they are less than DISK_READAHEAD_GAP sectors apart, and read in chunks of
+ * about DISK_READAHEAD_CHUNK sectors, skipping what is cached already. Chunks
+ * end between extents, so a later read of one finds it in a single cached run.
+ * Needs the cache on */
+void diskReadahead(DiskInfo *diskInfo, DiskExtent *extents, uint32_t count);
+
+/* Record the reads made from `diskInfo`, cached or not, until diskRecordStop,
+ * which copies up to `max` of them to `extents` in the order they were first
+ * made and returns how many it copied. One disk at a time */
+void diskRecordStart(DiskInfo *diskInfo);
+uint32_t diskRecordStop(DiskExtent *extents, uint32_t max);
+
 #endif // DISK_H
\ No newline at end of file
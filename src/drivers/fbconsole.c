@@ -0,0 +1,313 @@
+#include "fbconsole.h"
+#include "bga.h"
+#include "vga.h"
+#include "../cpu/spinlock.h"
+#include "../libc/mem.h"
+
+#define FBCON_MAX_ROWS     128
+#define FBCON_GLYPH_PIXELS (FBCON_GLYPH_WIDTH * FBCON_GLYPH_HEIGHT)
+#define FBCON_CURSOR_LINES 2        // Underline at the bottom of the cursor's cell
+#define NO_CELL            0xFFFFFFFF
+
+/* The cells, the back buffer and the cursor are shared by every CPU and IRQ
+ * that prints, the public calls after fbconInit hold consoleLock */
+static Spinlock consoleLock = SPINLOCK_INIT;
+static Framebuffer screen;
+static bool active = false;
+static uint32_t columns = 0;
+static uint32_t rows = 0;
+static uint32_t scrollTop = 0;
+static uint32_t foreground = FBCON_FOREGROUND;
+static uint32_t background = FBCON_BACKGROUND;
+
+static byte *font = NULL;           // 16 bytes per glyph, one bit per pixel
+static uint32_t *glyphs = NULL;     // Every glyph rendered in the current colors
+static uint32_t *back = NULL;       // The whole screen, `screen.width` pixels per line
+static char *cells = NULL;          // What each cell shows, to redraw it
+static uint32_t cursor = 0;         // Cell index
+static uint32_t drawnCursor = NO_CELL;
+
+// Columns of each text row changed since the last flush, clean when first > last
+static uint16_t dirtyFirst[FBCON_MAX_ROWS];
+static uint16_t dirtyLast[FBCON_MAX_ROWS];
+
+static void markDirty(uint32_t row, uint32_t first, uint32_t last) {
+    if (first < dirtyFirst[row]) dirtyFirst[row] = (uint16_t)first;
+    if (last > dirtyLast[row]) dirtyLast[row] = (uint16_t)last;
+}
+
+static void markRowsDirty(uint32_t first, uint32_t last) {
+    for (uint32_t row = first; row <= last; row++)
+        markDirty(row, 0, columns - 1);
+}
+
+static void fillPixels(uint32_t *dest, uint32_t value, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        dest[i] = value;
+}
+
+static void renderGlyphs() {
+    uint32_t *pixel = glyphs;
+    for (uint32_t line = 0; line < 256 * FBCON_GLYPH_HEIGHT; line++) {
+        byte bits = font[line];
+        for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++)
+            *pixel++ = (bits & (0x80 >> x)) ? foreground : background;
+    }
+}
+
+// Copy the cell's glyph into the back buffer, 8 pixels a line
+static void drawCell(uint32_t cell) {
+    if (cell >= columns * rows)
+        return;
+    uint32_t col = cell % columns;
+    uint32_t row = cell / columns;
+    uint32_t *source = &glyphs[(uint8_t)cells[cell] * FBCON_GLYPH_PIXELS];
+    uint32_t *dest = &back[row * FBCON_GLYPH_HEIGHT * screen.width + col * FBCON_GLYPH_WIDTH];
+    for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+        dest[0] = source[0]; dest[1] = source[1]; dest[2] = source[2]; dest[3] = source[3];
+        dest[4] = source[4]; dest[5] = source[5]; dest[6] = source[6]; dest[7] = source[7];
+        source += FBCON_GLYPH_WIDTH;
+        dest += screen.width;
+    }
+    markDirty(row, col, col);
+}
+
+static void drawCursor() {
+    if (drawnCursor != NO_CELL)
+        drawCell(drawnCursor);
+    drawnCursor = NO_CELL;
+    if (cursor >= columns * rows)
+        return;
+    uint32_t col = cursor % columns;
+    uint32_t row = cursor / columns;
+    uint32_t *dest = &back[((row + 1) * FBCON_GLYPH_HEIGHT - FBCON_CURSOR_LINES) * screen.width + col * FBCON_GLYPH_WIDTH];
+    for (uint32_t y = 0; y < FBCON_CURSOR_LINES; y++, dest += screen.width)
+        fillPixels(dest, foreground, FBCON_GLYPH_WIDTH);
+    markDirty(row, col, col);
+    drawnCursor = cursor;
+}
+
+// Copy the dirty spans to video memory
+static void flush() {
+    drawCursor();
+    for (uint32_t row = 0; row < rows; row++) {
+        if (dirtyFirst[row] > dirtyLast[row])
+            continue;
+        uint32_t x = dirtyFirst[row] * FBCON_GLYPH_WIDTH;
+        uint32_t bytes = (dirtyLast[row] - dirtyFirst[row] + 1) * FBCON_GLYPH_WIDTH * sizeof(uint32_t);
+        uint32_t line = row * FBCON_GLYPH_HEIGHT;
+        for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++, line++)
+            memcpy((char *)&back[line * screen.width + x], (char *)&screen.pixels[line * screen.pitch + x], bytes);
+        dirtyFirst[row] = (uint16_t)columns;
+        dirtyLast[row] = 0;
+    }
+}
+
+static void clearRows(uint32_t first, uint32_t count) {
+    memset(&cells[first * columns], ' ', count * columns);
+    fillPixels(&back[first * FBCON_GLYPH_HEIGHT * screen.width], background,
+               count * FBCON_GLYPH_HEIGHT * screen.width);
+    markRowsDirty(first, first + count - 1);
+}
+
+// Scroll the rows below scrollTop up by `lines`
+static void scroll(uint32_t lines) {
+    uint32_t region = rows - scrollTop;
+    // The underline would move with the pixels
+    if (drawnCursor != NO_CELL)
+        drawCell(drawnCursor);
+    drawnCursor = NO_CELL;
+
+    if (lines >= region) {
+        clearRows(scrollTop, region);
+        cursor = scrollTop * columns;
+        return;
+    }
+    uint32_t kept = region - lines;
+    memmove(&cells[(scrollTop + lines) * columns], &cells[scrollTop * columns], kept * columns);
+    uint32_t rowPixels = FBCON_GLYPH_HEIGHT * screen.width;
+    memmove((char *)&back[(scrollTop + lines) * rowPixels], (char *)&back[scrollTop * rowPixels],
+            kept * rowPixels * sizeof(uint32_t));
+    clearRows(scrollTop + kept, lines);
+    markRowsDirty(scrollTop, rows - 1);
+    cursor -= lines * columns;
+}
+
+static inline void put(char c) {
+    if (c == '\n') {
+        cursor = (cursor / columns + 1) * columns;
+    } else {
+        // Only past the end if the caller's scroll was wrong
+        if (cursor >= columns * rows)
+            cursor = columns * rows - 1;
+        cells[cursor] = c;
+        drawCell(cursor);
+        cursor++;
+    }
+}
+
+bool fbconInit(uint32_t width, uint32_t height) {
+    if (active || !bgaAvailable() || height / FBCON_GLYPH_HEIGHT > FBCON_MAX_ROWS)
+        return false;
+
+    // The font has to come out of VGA memory while it's still in text mode
+    font = (byte *)malloc(256 * FBCON_GLYPH_HEIGHT);
+    vgaReadFont(font);
+    if (!bgaSetMode(width, height, &screen)) {
+        free(font);
+        font = NULL;
+        return false;
+    }
+
+    columns = width / FBCON_GLYPH_WIDTH;
+    rows = height / FBCON_GLYPH_HEIGHT;
+    glyphs = (uint32_t *)malloc(256 * FBCON_GLYPH_PIXELS * sizeof(uint32_t));
+    back = (uint32_t *)malloc(screen.width * screen.height * sizeof(uint32_t));
+    cells = (char *)malloc(columns * rows);
+    renderGlyphs();
+
+    for (uint32_t row = 0; row < rows; row++) {
+        dirtyFirst[row] = (uint16_t)columns;
+        dirtyLast[row] = 0;
+    }
+    clearRows(0, rows);
+    cursor = 0;
+    active = true;
+    flush();
+    return true;
+}
+
+bool fbconActive() {
+    return active;
+}
+
+uint32_t fbconColumns() {
+    return columns;
+}
+
+uint32_t fbconRows() {
+    return rows;
+}
+
+/* Same as the text mode console: find where the run ends first, so it
+ * scrolls at most once and skips whatever would scroll out right away */
+void fbconWrite(char *string, uint32_t len, char placeholder) {
+    if (placeholder == '\0') {
+        uint32_t n = 0;
+        while (n < len && string[n] != '\0')
+            n++;
+        len = n;
+    }
+    if (len == 0)
+        return;
+
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    uint32_t region = rows - scrollTop;
+    uint32_t rowStart[FBCON_MAX_ROWS];
+    uint32_t cursorRow = cursor / columns - scrollTop;
+    uint32_t row = cursorRow;
+    uint32_t col = cursor % columns;
+    rowStart[row % region] = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (string[i] == '\n' || ++col == columns) {
+            row++;
+            col = 0;
+            rowStart[row % region] = i + 1;
+        }
+    }
+
+    uint32_t first = 0;
+    if (row + 1 > region) {
+        uint32_t overflow = row + 1 - region;
+        if (overflow > cursorRow) {
+            // The cursor's row scrolls out, so does the start of the run
+            first = rowStart[overflow % region];
+            scroll(region);
+        } else {
+            scroll(overflow);
+        }
+    }
+
+    for (uint32_t i = first; i < len; i++)
+        put(string[i] == '\0' ? placeholder : string[i]);
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void fbconWriteAt(uint32_t col, uint32_t row, char *string, uint32_t len) {
+    if (row >= rows)
+        return;
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    for (uint32_t i = 0; i < len && col + i < columns && string[i] != '\0'; i++) {
+        uint32_t cell = row * columns + col + i;
+        cells[cell] = string[i];
+        drawCell(cell);
+    }
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void fbconBackspace() {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    if (cursor > scrollTop * columns) {
+        cursor--;
+        if (cursor < columns * rows) {
+            cells[cursor] = ' ';
+            drawCell(cursor);
+        }
+        flush();
+    }
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void fbconClear() {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    clearRows(0, rows);
+    drawnCursor = NO_CELL;
+    cursor = scrollTop * columns;
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+uint32_t fbconGetCursor() {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    uint32_t cell = cursor;
+    spinUnlockIrqRestore(&consoleLock, flags);
+    return cell;
+}
+
+void fbconSetCursor(uint32_t cell) {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    if (cell < scrollTop * columns)
+        cell = scrollTop * columns;
+    if (cell > columns * rows)
+        cell = columns * rows;
+    cursor = cell;
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void fbconSetScrollTop(uint32_t row) {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    if (row >= rows)
+        row = rows - 1;
+    scrollTop = row;
+    if (cursor < scrollTop * columns)
+        cursor = scrollTop * columns;
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void fbconSetColors(uint32_t newForeground, uint32_t newBackground) {
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    foreground = newForeground;
+    background = newBackground;
+    if (active) {
+        renderGlyphs();
+        for (uint32_t cell = 0; cell < columns * rows; cell++)
+            drawCell(cell);
+        drawnCursor = NO_CELL;
+        flush();
+    }
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
@@ -0,0 +1,54 @@
+#ifndef FBCONSOLE_H
+#define FBCONSOLE_H
+
+#include "../types.h"
+
+/* Text console on a Bochs VBE linear framebuffer, e.g. 128x48 characters at
+ * 1024x768. Every glyph is pre-rendered in the current colors, so drawing a
+ * character copies 16 rows of 8 pixels into a back buffer; each text row
+ * tracks the columns changed since the last flush, and only those spans are
+ * copied to video memory, a word or more at a time, once per public call.
+ *
+ * Once fbconInit succeeds the vga functions draw here instead of in text mode.
+ * Rows above the scroll top stay put, for status lines updated in place with
+ * fbconWriteAt while the rest of the console scrolls. Built in with
+ * CFLAGS=-DFRAMEBUFFER. */
+
+#define FBCON_WIDTH        1024
+#define FBCON_HEIGHT       768
+#define FBCON_GLYPH_WIDTH  8
+#define FBCON_GLYPH_HEIGHT 16
+
+#define FBCON_FOREGROUND   0x00C0C0C0
+#define FBCON_BACKGROUND   0x00000000
+
+/* Switch to a `width` x `height` framebuffer and take over the console.
+ * Returns false and stays in text mode without a Bochs VBE adapter */
+bool fbconInit(uint32_t width, uint32_t height);
+
+bool fbconActive();
+
+uint32_t fbconColumns();
+uint32_t fbconRows();
+
+/* Write at the cursor. NUL bytes are drawn as `placeholder`, unless it is
+ * NUL itself, then the run ends at the first one */
+void fbconWrite(char *string, uint32_t len, char placeholder);
+
+/* Write at a fixed cell without moving the cursor or scrolling, clipped at the end of the row */
+void fbconWriteAt(uint32_t col, uint32_t row, char *string, uint32_t len);
+
+void fbconBackspace();
+void fbconClear();
+
+/* Cursor as a cell index, row * fbconColumns() + column */
+uint32_t fbconGetCursor();
+void fbconSetCursor(uint32_t cell);
+
+/* Keep the rows above `row` out of scrolling. The cursor moves below them if needed */
+void fbconSetScrollTop(uint32_t row);
+
+/* Colors as 0x00RRGGBB, redraws the screen */
+void fbconSetColors(uint32_t foreground, uint32_t background);
+
+#endif // FBCONSOLE_H
@@ -1,14 +1,46 @@
 #include "keyboard.h"
 #include "ports.h"
+#include "vga.h"
 #include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../cpu/utils.h"
+#include "../debug.h"
+#include "../libc/string.h"
+#include "../libc/ring.h"
+#include "../kernel/deferred.h"
+#include "../kernel/thread.h"
 
 #define BACKSPACE 0x0E
 #define ENTER 0x1C
+#define LCTRL 0x1D
 #define LSHIFT 0x2A
 #define RSHIFT 0x36
+#define LALT 0x38
+#define CAPSLOCK 0x3A
+#define RELEASED 0x80
 
-static char key_buffer[256];
-static int shift_pressed = 0;
+static TaskEvent key_event;
+
+// Key events from the IRQ handler, turned into text on the deferred thread
+static KeyEvent event_storage[KEYBOARD_EVENT_RING_SIZE];
+static SpscRing events;
+static DeferredWork key_work;
+static uint8_t modifiers = 0;   // Only the IRQ handler changes it
+static uint32_t dropped_keys = 0;
+
+// The line being edited, only the deferred thread touches it
+static char line_storage[KEYBOARD_LINE_LENGTH];
+static StringBuffer line;
+
+/* Finished lines, each ending in '\n'. The deferred thread pushes whole lines
+ * and counts them in lines_finished; readers pop a line at a time with
+ * interrupts disabled, which also keeps them from racing each other, since
+ * threads only run on the boot CPU */
+static byte input_storage[KEYBOARD_INPUT_SIZE];
+static SpscRing input;
+static volatile uint32_t lines_finished = 0;
+static uint32_t lines_read = 0;
+static Thread *blocked_reader = NULL;
 
 #define SC_MAX 57
 const char *sc_name[] = { "ERROR", "Esc", "1", "2", "3", "4", "5", "6", 
@@ -30,29 +62,145 @@ const char sc_shifted_ascii[] = {'?', '?', '!', '@', '#', '$', '%', '^',
                                 'H', 'J', 'K', 'L', ':', '"', '~', '?', '|', 'Z', 'X', 'C', 'V',
                                 'B', 'N', 'M', '<', '>', '?', '?', '?', ' '};
 
-static void keyboard_callback(registers_t regs) {
+static void update_modifiers(uint8_t scancode) {
+    bool released = (scancode & RELEASED) != 0;
+    uint8_t flag;
+    switch (scancode & ~RELEASED) {
+        case LSHIFT: flag = KEY_MOD_LSHIFT; break;
+        case RSHIFT: flag = KEY_MOD_RSHIFT; break;
+        case LCTRL: flag = KEY_MOD_CTRL; break;     // Right ctrl and alt send the same codes after 0xE0
+        case LALT: flag = KEY_MOD_ALT; break;
+        case CAPSLOCK:
+            if (!released)
+                modifiers ^= KEY_MOD_CAPSLOCK;
+            return;
+        default:
+            return;
+    }
+    if (released)
+        modifiers &= ~flag;
+    else
+        modifiers |= flag;
+}
+
+static void keyboard_callback(registers_t *regs) {
     /* The PIC leaves us the scancode in port 0x60 */
-    uint8_t scancode = portByteIn(0x60);
+    KeyEvent event;
+    event.scancode = portByteIn(0x60);
+    update_modifiers(event.scancode);
+    event.modifiers = modifiers;
+    event.timestamp = getNanosecondsSinceBoot();
+    if (!spscPush(&events, &event))
+        dropped_keys++;
+    deferredSchedule(&key_work);
+}
 
-    if (scancode == LSHIFT || scancode == RSHIFT) {
-        shift_pressed = 1;
-        return;
-    } else if (scancode == (LSHIFT | 0x80) || scancode == (RSHIFT | 0x80)) {
-        shift_pressed = 0;
-        return;
+static char translate(KeyEvent *event) {
+    char letter = sc_ascii[event->scancode];
+    if (letter == '?')
+        return '\0';   // Not a printable key
+    bool shifted = (event->modifiers & KEY_MOD_SHIFT) != 0;
+    // Caps lock only shifts letters
+    if ((event->modifiers & KEY_MOD_CAPSLOCK) && letter >= 'a' && letter <= 'z')
+        shifted = !shifted;
+    return shifted ? sc_shifted_ascii[event->scancode] : letter;
+}
+
+// Queue the edited line for readers, or drop it if they've fallen that far behind
+static void finish_line() {
+    if (spscCount(&input) + line.length + 1 <= KEYBOARD_INPUT_SIZE) {
+        for (uint32_t i = 0; i < line.length; i++)
+            spscPush(&input, &line.chars[i]);
+        spscPush(&input, "\n");
+
+        uint32_t flags = irqSave();
+        lines_finished++;
+        if (blocked_reader)
+            threadWake(blocked_reader);
+        irqRestore(flags);
+    } else {
+        LOG_WARN(LOG_CAT_DRIVERS, "Keyboard input full, dropped a line of %u characters", line.length);
     }
-    if (scancode > SC_MAX) return;
-    if (scancode == BACKSPACE) {
-        if (backspace(key_buffer)) {
+    stringBufferClear(&line);
+}
+
+static void handle_event(KeyEvent *event) {
+    uint8_t scancode = event->scancode;
+    if ((scancode & RELEASED) || scancode > SC_MAX)
+        return;
 
-        }
+    if (scancode == BACKSPACE) {
+        if (stringBufferBackspace(&line))
+            vgaWriteBackspace();
     } else if (scancode == ENTER) {
-        key_buffer[0] = '\0';
+        vgaNextLine();
+        finish_line();
     } else {
-        char letter = shift_pressed?sc_shifted_ascii[(int)scancode]:sc_ascii[(int)scancode];
-        append(key_buffer, letter);
+        char letter = translate(event);
+        if (letter == '\0')
+            return;
+        if (stringBufferAppend(&line, letter))
+            vgaWriteChar(letter);
     }
+    LOG_DEBUG(LOG_CAT_DRIVERS, "Key %x echoed %u ns after its IRQ", scancode,
+              (uint32_t)(getNanosecondsSinceBoot() - event->timestamp));
+    taskSignal(&key_event);
+}
+
+static void keyboard_bottom_half(void *arg) {
+    KeyEvent event;
+    while (spscPop(&events, &event))
+        handle_event(&event);
 }
+
 void init_keyboard() {
-   register_interrupt_handler(IRQ1, keyboard_callback);
-}
\ No newline at end of file
+    stringBufferInit(&line, line_storage, sizeof(line_storage));
+    taskEventInit(&key_event);
+    spscInit(&events, event_storage, KEYBOARD_EVENT_RING_SIZE, sizeof(KeyEvent));
+    spscInit(&input, input_storage, KEYBOARD_INPUT_SIZE, 1);
+    deferredWorkInit(&key_work, keyboard_bottom_half, NULL);
+    register_interrupt_handler(IRQ1, keyboard_callback);
+}
+
+TaskEvent *keyboardEvent() {
+    return &key_event;
+}
+
+// Pop one finished line, with interrupts disabled by the caller
+static uint32_t take_line(char *buffer, uint32_t size) {
+    uint32_t length = 0;
+    char c;
+    while (spscPop(&input, &c) && c != '\n') {
+        if (length + 1 < size)
+            buffer[length++] = c;
+    }
+    if (size > 0)
+        buffer[length] = '\0';
+    lines_read++;
+    return length;
+}
+
+int keyboardTryReadLine(char *buffer, uint32_t size) {
+    uint32_t flags = irqSave();
+    int length = -1;
+    if (lines_finished != lines_read)
+        length = (int)take_line(buffer, size);
+    irqRestore(flags);
+    return length;
+}
+
+uint32_t keyboardReadLine(char *buffer, uint32_t size) {
+    uint32_t flags = irqSave();
+    while (lines_finished == lines_read) {
+        blocked_reader = threadCurrent();
+        threadBlock();
+    }
+    blocked_reader = NULL;
+    uint32_t length = take_line(buffer, size);
+    irqRestore(flags);
+    return length;
+}
+
+uint32_t keyboardDroppedKeys() {
+    return dropped_keys;
+}
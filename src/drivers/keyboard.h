@@ -2,7 +2,44 @@
 #define KEYBOARD_H
 
 #include "../types.h"
+#include "../kernel/task.h"
+
+/* PS/2 keyboard. The IRQ only records a KeyEvent into a lock-free ring; the
+ * line discipline runs on the deferred thread, turns the events into text,
+ * echoes it and handles backspace, and queues every line finished with Enter
+ * for readers. A full ring drops keys, a line that doesn't fit is cut off. */
+
+#define KEYBOARD_EVENT_RING_SIZE 64     // Key events between the IRQ and the line discipline
+#define KEYBOARD_LINE_LENGTH     256    // Longest line being edited, terminator included
+#define KEYBOARD_INPUT_SIZE      1024   // Bytes of finished lines waiting for readers
+
+#define KEY_MOD_LSHIFT   0x01
+#define KEY_MOD_RSHIFT   0x02
+#define KEY_MOD_CTRL     0x04
+#define KEY_MOD_ALT      0x08
+#define KEY_MOD_CAPSLOCK 0x10
+#define KEY_MOD_SHIFT    (KEY_MOD_LSHIFT | KEY_MOD_RSHIFT)
+
+typedef struct {
+    uint64_t timestamp;     // Nanoseconds since boot when the IRQ read it
+    uint8_t scancode;       // Set 1, bit 7 set when the key is released
+    uint8_t modifiers;      // KEY_MOD_* in effect, this key's own change included
+} KeyEvent;
 
 void init_keyboard();
 
-#endif
\ No newline at end of file
+/* Signalled on every key press and finished line, for tasks waiting for input */
+TaskEvent *keyboardEvent();
+
+/* Take the oldest finished line without its newline, NUL-terminated and cut
+ * to `size` - 1 characters. Returns its length, or -1 right away if there is
+ * no finished line */
+int keyboardTryReadLine(char *buffer, uint32_t size);
+
+/* Same, but blocks the calling thread until a line is finished */
+uint32_t keyboardReadLine(char *buffer, uint32_t size);
+
+/* Keys dropped because the event ring was full */
+uint32_t keyboardDroppedKeys();
+
+#endif
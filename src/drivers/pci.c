@@ -0,0 +1,44 @@
+#include "pci.h"
+#include "ports.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+static void portLongOut(uint16_t port, uint32_t data) {
+    __asm__ __volatile__("out %%eax, %%dx" : : "a" (data), "d" (port));
+}
+
+static uint32_t portLongIn(uint16_t port) {
+    uint32_t result;
+    __asm__ __volatile__("in %%dx, %%eax" : "=a" (result) : "d" (port));
+    return result;
+}
+
+uint32_t pciConfigRead(PciAddress *address, uint8_t offset) {
+    portLongOut(PCI_CONFIG_ADDRESS, 0x80000000 | ((uint32_t)address->bus << 16) |
+                ((uint32_t)address->device << 11) | ((uint32_t)address->function << 8) | (offset & 0xFC));
+    return portLongIn(PCI_CONFIG_DATA);
+}
+
+bool pciFindDevice(uint16_t vendor, uint16_t device, PciAddress *address) {
+    uint32_t wanted = ((uint32_t)device << 16) | vendor;
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint32_t slot = 0; slot < 32; slot++) {
+            for (uint32_t function = 0; function < 8; function++) {
+                PciAddress candidate = { (uint8_t)bus, (uint8_t)slot, (uint8_t)function };
+                uint32_t id = pciConfigRead(&candidate, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    // No function 0 means no device in the slot
+                    if (function == 0)
+                        break;
+                    continue;
+                }
+                if (id == wanted) {
+                    *address = candidate;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
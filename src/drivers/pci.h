@@ -0,0 +1,22 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "../types.h"
+
+/* PCI configuration space through the legacy 0xCF8/0xCFC mechanism */
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_BAR0      0x10
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+} PciAddress;
+
+uint32_t pciConfigRead(PciAddress *address, uint8_t offset);
+
+/* Find the first function with the given vendor and device IDs, scanning every bus */
+bool pciFindDevice(uint16_t vendor, uint16_t device, PciAddress *address);
+
+#endif // PCI_H
@@ -0,0 +1,155 @@
+#include "serial.h"
+#include "ports.h"
+#include "../cpu/isr.h"
+#include "../cpu/spinlock.h"
+#include "../libc/ring.h"
+#include "../libc/string.h"
+
+#define SERIAL_DATA        (SERIAL_COM1 + 0)
+#define SERIAL_INT_ENABLE  (SERIAL_COM1 + 1)
+#define SERIAL_FIFO_CTRL   (SERIAL_COM1 + 2) // Written
+#define SERIAL_INT_ID      (SERIAL_COM1 + 2) // Read
+#define SERIAL_LINE_CTRL   (SERIAL_COM1 + 3)
+#define SERIAL_MODEM_CTRL  (SERIAL_COM1 + 4)
+#define SERIAL_LINE_STATUS (SERIAL_COM1 + 5)
+
+#define SERIAL_LSR_THRE     0x20 // Transmit holding register (and FIFO) empty
+#define SERIAL_IER_THRE     0x02
+#define SERIAL_IIR_NONE     0x01 // No interrupt pending
+#define SERIAL_MCR_DTR_RTS  0x03
+#define SERIAL_MCR_OUT2     0x08 // Connects the UART's interrupt line on PCs
+#define SERIAL_FIFO_SIZE    16
+
+#define EFLAGS_IF 0x200
+
+// Bytes waiting for the transmitter. Writers take txLock among themselves and
+// to switch the THRE interrupt, the interrupt handler drains it without locking
+static byte txStorage[SERIAL_TX_RING_SIZE];
+static SpscRing tx;
+static Spinlock txLock = SPINLOCK_INIT;
+static volatile bool interruptDriven = false;
+static uint32_t dropped = 0;
+
+static void writePolled(char c) {
+    while ((portByteIn(SERIAL_LINE_STATUS) & SERIAL_LSR_THRE) == 0) {}
+    portByteOut(SERIAL_DATA, c);
+}
+
+static void serialInterrupt(registers_t *regs) {
+    // Reading the IIR acknowledges a THRE interrupt
+    if (portByteIn(SERIAL_INT_ID) & SERIAL_IIR_NONE)
+        return;
+    if ((portByteIn(SERIAL_LINE_STATUS) & SERIAL_LSR_THRE) == 0)
+        return;
+
+    // The FIFO is empty, refill it
+    byte c;
+    uint32_t sent = 0;
+    while (sent < SERIAL_FIFO_SIZE && spscPop(&tx, &c)) {
+        portByteOut(SERIAL_DATA, c);
+        sent++;
+    }
+    if (sent == 0) {
+        // Nothing left, stop the interrupt until a writer queues more
+        spinLock(&txLock);
+        if (spscEmpty(&tx))
+            portByteOut(SERIAL_INT_ENABLE, 0x00);
+        spinUnlock(&txLock);
+    }
+}
+
+static void writeBytes(char *data, uint32_t len) {
+    if (!interruptDriven) {
+        for (uint32_t i = 0; i < len; i++) {
+            if (data[i] == '\n')
+                writePolled('\r');
+            writePolled(data[i]);
+        }
+        return;
+    }
+
+    uint32_t i = 0;
+    bool returnQueued = false;   // The '\r' in front of data[i] is already in the ring
+    while (i < len) {
+        uint32_t flags = spinLockIrqSave(&txLock);
+        for (; i < len; i++) {
+            if (data[i] == '\n' && !returnQueued) {
+                if (!spscPush(&tx, "\r"))
+                    break;
+                returnQueued = true;
+            }
+            if (!spscPush(&tx, &data[i]))
+                break;
+            returnQueued = false;
+        }
+        // Raises an interrupt at once if the transmitter is idle
+        portByteOut(SERIAL_INT_ENABLE, SERIAL_IER_THRE);
+        spinUnlockIrqRestore(&txLock, flags);
+
+        if (i < len) {
+            // Full. Wait for the interrupt to make room, unless it can't run
+            if ((flags & EFLAGS_IF) == 0) {
+                dropped += len - i;
+                return;
+            }
+            __asm__ __volatile__("rep; nop"); // pause
+        }
+    }
+}
+
+void serialInit() {
+    portByteOut(SERIAL_INT_ENABLE, 0x00);
+    portByteOut(SERIAL_LINE_CTRL, 0x80);  // DLAB on, to set the baud rate divisor
+    portByteOut(SERIAL_DATA, 0x01);       // 115200 / 1
+    portByteOut(SERIAL_INT_ENABLE, 0x00);
+    portByteOut(SERIAL_LINE_CTRL, 0x03);  // 8 bits, no parity, one stop bit
+    portByteOut(SERIAL_FIFO_CTRL, 0xC7);  // Enable and clear the FIFOs
+    portByteOut(SERIAL_MODEM_CTRL, SERIAL_MCR_DTR_RTS | SERIAL_MCR_OUT2);
+    spscInit(&tx, txStorage, SERIAL_TX_RING_SIZE, 1);
+}
+
+void serialInitInterrupts() {
+    register_interrupt_handler(IRQ4, serialInterrupt);
+    interruptDriven = true;
+}
+
+void serialSetPolled() {
+    uint32_t flags = irqSave();
+    if (interruptDriven) {
+        interruptDriven = false;
+        portByteOut(SERIAL_INT_ENABLE, 0x00);
+        // Whatever writer was interrupted, the queued bytes still go out in order
+        byte c;
+        while (spscPop(&tx, &c))
+            writePolled(c);
+    }
+    irqRestore(flags);
+}
+
+uint32_t serialDropped() {
+    return dropped;
+}
+
+void serialWriteChar(char c) {
+    writeBytes(&c, 1);
+}
+
+void serialWrite(char *string) {
+    writeBytes(string, strlen(string));
+}
+
+void serialWriteStatic(char *string, uint32_t len) {
+    writeBytes(string, len);
+}
+
+void serialWriteInt(int num) {
+    char buffer[12];
+    int_to_ascii(num, buffer);
+    serialWrite(buffer);
+}
+
+void serialWriteHex(uint32_t num) {
+    char buffer[11];
+    hex_to_ascii(num, buffer);
+    serialWrite(buffer);
+}
@@ -0,0 +1,34 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "../types.h"
+
+#define SERIAL_COM1 0x3F8
+
+#define SERIAL_TX_RING_SIZE 4096    // Bytes queued for the transmitter, a power of two
+
+/* COM1 16550 UART. Output is polled until serialInitInterrupts, after that
+ * writers only queue into a ring that the transmitter's interrupt drains 16
+ * bytes (a FIFO) at a time. Writers wait while the ring is full, or drop what
+ * doesn't fit when called with interrupts disabled. */
+
+/* Set up COM1 as 115200 baud, 8N1, with the FIFOs enabled */
+void serialInit();
+
+/* Switch to interrupt driven output. Call after isr_install */
+void serialInitInterrupts();
+
+/* Flush the ring and go back to polled output for good, for panics.
+ * Works with interrupts disabled */
+void serialSetPolled();
+
+/* Bytes dropped because the ring was full */
+uint32_t serialDropped();
+
+void serialWriteChar(char c);
+void serialWrite(char *string);
+void serialWriteStatic(char *string, uint32_t len);
+void serialWriteInt(int num);
+void serialWriteHex(uint32_t num);
+
+#endif // SERIAL_H
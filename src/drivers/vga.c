@@ -1,4 +1,7 @@
+#include "vga.h"
+#include "fbconsole.h"
 #include "../drivers/ports.h"
+#include "../cpu/spinlock.h"
 #include "../libc/mem.h"
 #include "../libc/string.h"
 
@@ -6,37 +9,178 @@
 #define REG_SCREEN_DATA 0x3d5
 
 #define VGA_ADDRESS 0xb8000
+#define VGA_PLANES_ADDRESS 0xa0000
+
+#define REG_SEQUENCER_INDEX 0x3c4
+#define REG_SEQUENCER_DATA  0x3c5
+#define REG_GRAPHICS_INDEX  0x3ce
+#define REG_GRAPHICS_DATA   0x3cf
 
 #define MAX_ROWS 25
 #define MAX_COLS 80
 
+#define WHITE_ON_BLACK 0x0f
+
+/* The screen is kept in a RAM shadow together with the cursor. Writes only
+ * touch the shadow and mark rows dirty; flush() then copies the dirty rows to
+ * video memory and moves the hardware cursor, once per public call. Threads,
+ * IRQs and the other CPUs all print, so every public call holds consoleLock. */
+static Spinlock consoleLock = SPINLOCK_INIT;
+static uint16_t shadow[MAX_ROWS * MAX_COLS];
+static int cursor = 0;                  // Cell index
+static int dirtyFirst = MAX_ROWS;       // Rows to copy out, empty when first > last
+static int dirtyLast = -1;
+static int hwCursor = -1;               // Where the hardware cursor was last put
+static bool loaded = false;
+
+static inline uint16_t cell(char c) {
+    return (uint16_t)((WHITE_ON_BLACK << 8) | (uint8_t)c);
+}
+
+static void markDirty(int first, int last) {
+    if (first < dirtyFirst) dirtyFirst = first;
+    if (last > dirtyLast) dirtyLast = last;
+}
+
+static void setHardwareCursor(int position) {
+    portByteOut(REG_SCREEN_CTRL, 14);
+    portByteOut(REG_SCREEN_DATA, (unsigned char)(position >> 8));
+    portByteOut(REG_SCREEN_CTRL, 15);
+    portByteOut(REG_SCREEN_DATA, (unsigned char)(position & 0xff));
+    hwCursor = position;
+}
+
+// Take over whatever the bootloader left on the screen
+static void load() {
+    if (loaded)
+        return;
+    loaded = true;
+    memcpy((char *)VGA_ADDRESS, (char *)shadow, sizeof(shadow));
+    portByteOut(REG_SCREEN_CTRL, 14);
+    int position = portByteIn(REG_SCREEN_DATA) << 8;
+    portByteOut(REG_SCREEN_CTRL, 15);
+    position += portByteIn(REG_SCREEN_DATA);
+    cursor = position < MAX_ROWS * MAX_COLS ? position : 0;
+    hwCursor = position;
+}
+
+static void flush() {
+    if (dirtyFirst <= dirtyLast) {
+        int offset = dirtyFirst * MAX_COLS;
+        memcpy((char *)&shadow[offset], (char *)VGA_ADDRESS + offset * 2, (dirtyLast - dirtyFirst + 1) * MAX_COLS * 2);
+        dirtyFirst = MAX_ROWS;
+        dirtyLast = -1;
+    }
+    if (cursor != hwCursor)
+        setHardwareCursor(cursor);
+}
+
+static void scroll(int lines) {
+    if (lines >= MAX_ROWS) {
+        memset((char *)shadow, 0, sizeof(shadow));
+        cursor = 0;
+    } else {
+        int kept = (MAX_ROWS - lines) * MAX_COLS;
+        memmove((char *)&shadow[lines * MAX_COLS], (char *)shadow, kept * 2);
+        memset((char *)&shadow[kept], 0, lines * MAX_COLS * 2);
+        cursor -= lines * MAX_COLS;
+    }
+    markDirty(0, MAX_ROWS - 1);
+}
+
+// Put a character at the cursor, scrolling is left to the caller
+static inline void put(char c) {
+    if (c == '\n') {
+        cursor = (cursor / MAX_COLS + 1) * MAX_COLS;
+    } else {
+        // Only past the end if the caller's scroll was wrong
+        if (cursor >= MAX_ROWS * MAX_COLS)
+            cursor = MAX_ROWS * MAX_COLS - 1;
+        shadow[cursor] = cell(c);
+        cursor++;
+    }
+}
+
+/* Write a run of characters with at most one scroll. `placeholder` replaces NUL
+ * bytes, a run without one ends at the first NUL or after `len` characters */
+static void writeRun(char *string, uint32_t len, char placeholder) {
+    load();
+    if (placeholder == '\0') {
+        uint32_t n = 0;
+        while (n < len && string[n] != '\0')
+            n++;
+        len = n;
+    }
+    if (len == 0)
+        return;
+
+    // Find the row the run ends on, and where each of the last rows started,
+    // so a run longer than the screen only writes what stays visible
+    uint32_t rowStart[MAX_ROWS];
+    int row = cursor / MAX_COLS;
+    int col = cursor % MAX_COLS;
+    rowStart[row % MAX_ROWS] = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (string[i] == '\n' || ++col == MAX_COLS) {
+            row++;
+            col = 0;
+            rowStart[row % MAX_ROWS] = i + 1;
+        }
+    }
+
+    int overflow = row - (MAX_ROWS - 1);
+    uint32_t first = 0;
+    if (overflow > cursor / MAX_COLS) {
+        // The cursor's row scrolls out, so does the start of the run
+        first = rowStart[overflow % MAX_ROWS];
+        scroll(MAX_ROWS);
+    } else if (overflow > 0) {
+        scroll(overflow);
+    }
+
+    int startRow = cursor / MAX_COLS;
+    for (uint32_t i = first; i < len; i++)
+        put(string[i] == '\0' ? placeholder : string[i]);
+    int endRow = (cursor - 1) / MAX_COLS;
+    markDirty(startRow, endRow < MAX_ROWS ? endRow : MAX_ROWS - 1);
+}
+
 int vgaGetOffset(int col, int row) {
     return 2 * (row * MAX_COLS + col);
 }
 
 int vgaGetOffsetRow(int offset) {
-    return offset / (2 * MAX_COLS); 
+    return offset / (2 * MAX_COLS);
 }
 
 int vgaGetOffsetCol(int offset) {
-    return (offset - (vgaGetOffsetRow(offset)*2*MAX_COLS))/2; 
+    return (offset - (vgaGetOffsetRow(offset)*2*MAX_COLS))/2;
 }
 
 int vgaGetCursor() {
-    portByteOut(0x3d4, 14);
-    int position = portByteIn(0x3d5);
-    position = position << 8;
-    portByteOut(0x3d4, 15);
-    position += portByteIn(0x3d5);
-    return position * 2;
+    if (fbconActive())
+        return fbconGetCursor() * 2;
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    load();
+    int offset = cursor * 2;
+    spinUnlockIrqRestore(&consoleLock, flags);
+    return offset;
 }
 
 void vgaSetCursor(int offset) {
-    offset /= 2;
-    portByteOut(REG_SCREEN_CTRL, 14);
-    portByteOut(REG_SCREEN_DATA, (unsigned char)(offset >> 8));
-    portByteOut(REG_SCREEN_CTRL, 15);
-    portByteOut(REG_SCREEN_DATA, (unsigned char)(offset & 0xff));
+    if (fbconActive()) {
+        fbconSetCursor(offset / 2);
+        return;
+    }
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    load();
+    cursor = offset / 2;
+    if (cursor < 0)
+        cursor = 0;
+    if (cursor > MAX_ROWS * MAX_COLS)
+        cursor = MAX_ROWS * MAX_COLS;
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaNextLine() {
@@ -44,71 +188,65 @@ void vgaNextLine() {
 }
 
 void vgaWriteChar(char c) {
-    int cursor = vgaGetCursor();
-    if (c == '\n') {
-        cursor /= 2 * MAX_COLS; // reset to beginning of line
-        cursor *= 2 * MAX_COLS;
-
-        cursor += 2 * MAX_COLS; // next line
-    } else {
-        char *vga = (char*)VGA_ADDRESS;
-        vga[cursor] = c; 
-        vga[cursor+1] = 0x0f;
-        cursor += 2;
+    if (fbconActive()) {
+        fbconWrite(&c, 1, c);
+        return;
     }
-
-    if (cursor >= MAX_ROWS * MAX_COLS * 2) {
-        int i;
-        for (i = 1; i < MAX_ROWS; i++) 
-            memcpy(vgaGetOffset(0, i) + VGA_ADDRESS,
-                        vgaGetOffset(0, i-1) + VGA_ADDRESS,
-                        MAX_COLS * 2);
-
-        /* Blank last line */
-        char *last_line = vgaGetOffset(0, MAX_ROWS-1) + VGA_ADDRESS;
-        for (i = 0; i < MAX_COLS * 2; i++) last_line[i] = 0;
-
-        cursor -= 2 * MAX_COLS;
-    }
-    vgaSetCursor(cursor);
-    
-    return;
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    writeRun(&c, 1, c);
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaWrite(char *string) {
-    int i = 0;
-    while (string[i] != 0) {
-        vgaWriteChar(string[i]);
-        i++;
+    if (fbconActive()) {
+        fbconWrite(string, 0xFFFFFFFF, '\0');
+        return;
     }
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    writeRun(string, 0xFFFFFFFF, '\0');
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaWriteStatic(char *string, uint32_t len) {
-    for (uint32_t i = 0; i < len; i++) {
-        if (string[i] == '\0')
-        {
-            vgaWriteChar('*');
-            continue;
-        }
-        vgaWriteChar(string[i]);
+    if (fbconActive()) {
+        fbconWrite(string, len, '*');
+        return;
     }
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    writeRun(string, len, '*');
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaWriteln(char *string) {
-    int i = 0;
-    while (string[i] != 0) {
-        vgaWriteChar(string[i]);
-        i++;
+    if (fbconActive()) {
+        fbconWrite(string, 0xFFFFFFFF, '\0');
+        fbconWrite("\n", 1, '\0');
+        return;
     }
-    vgaNextLine();
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    writeRun(string, 0xFFFFFFFF, '\0');
+    writeRun("\n", 1, '\0');
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaWriteBackspace() {
-    int cursor = vgaGetCursor();
-    char *vga = (char*)VGA_ADDRESS;
-    vga[cursor-2] = 0x00; 
-    vga[cursor-1] = 0x0f;
-    vgaSetCursor(cursor-2);
+    if (fbconActive()) {
+        fbconBackspace();
+        return;
+    }
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    load();
+    if (cursor > 0) {
+        cursor--;
+        shadow[cursor] = WHITE_ON_BLACK << 8;
+        markDirty(cursor / MAX_COLS, cursor / MAX_COLS);
+        flush();
+    }
+    spinUnlockIrqRestore(&consoleLock, flags);
 }
 
 void vgaWriteInt32(uint32_t num) {
@@ -120,9 +258,9 @@ void vgaWriteInt32(uint32_t num) {
 
 void vgaWriteInt(int num) {
     char buffer[64];
-    
+
     int_to_ascii(num, buffer);
-    
+
     vgaWrite(buffer);
 }
 
@@ -134,10 +272,36 @@ void vgaWriteByte(uint8_t num) {
 }
 
 void vgaClear() {
-    char *lastLine = (char*)VGA_ADDRESS;
-    for (int i = 0; i < MAX_COLS * MAX_ROWS * 2; i++)
-    {
-        lastLine[i] = 0;
+    if (fbconActive()) {
+        fbconClear();
+        return;
     }
-    vgaSetCursor(0);
-}
\ No newline at end of file
+    uint32_t flags = spinLockIrqSave(&consoleLock);
+    loaded = true;
+    memset((char *)shadow, 0, sizeof(shadow));
+    cursor = 0;
+    markDirty(0, MAX_ROWS - 1);
+    flush();
+    spinUnlockIrqRestore(&consoleLock, flags);
+}
+
+void vgaReadFont(byte *glyphs) {
+    // Make plane 2, where text mode keeps the font, readable at 0xA0000
+    portByteOut(REG_SEQUENCER_INDEX, 0x02); portByteOut(REG_SEQUENCER_DATA, 0x04); // Write to plane 2 only
+    portByteOut(REG_SEQUENCER_INDEX, 0x04); portByteOut(REG_SEQUENCER_DATA, 0x07); // Sequential addressing
+    portByteOut(REG_GRAPHICS_INDEX, 0x04); portByteOut(REG_GRAPHICS_DATA, 0x02);   // Read from plane 2
+    portByteOut(REG_GRAPHICS_INDEX, 0x05); portByteOut(REG_GRAPHICS_DATA, 0x00);   // No odd/even
+    portByteOut(REG_GRAPHICS_INDEX, 0x06); portByteOut(REG_GRAPHICS_DATA, 0x04);   // 64K at 0xA0000
+
+    // Each glyph has a 32 byte slot, the 8x16 font uses the first 16
+    byte *plane = (byte *)VGA_PLANES_ADDRESS;
+    for (uint32_t c = 0; c < 256; c++)
+        memcpy((char *)&plane[c * 32], (char *)&glyphs[c * 16], 16);
+
+    // Back to the text mode setup
+    portByteOut(REG_SEQUENCER_INDEX, 0x02); portByteOut(REG_SEQUENCER_DATA, 0x03);
+    portByteOut(REG_SEQUENCER_INDEX, 0x04); portByteOut(REG_SEQUENCER_DATA, 0x03);
+    portByteOut(REG_GRAPHICS_INDEX, 0x04); portByteOut(REG_GRAPHICS_DATA, 0x00);
+    portByteOut(REG_GRAPHICS_INDEX, 0x05); portByteOut(REG_GRAPHICS_DATA, 0x10);
+    portByteOut(REG_GRAPHICS_INDEX, 0x06); portByteOut(REG_GRAPHICS_DATA, 0x0E);
+}
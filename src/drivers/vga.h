@@ -19,4 +19,8 @@ void vgaWriteInt(int num);
 void vgaWriteByte(uint8_t num);
 void vgaClear();
 
+/* Copy the 8x16 font text mode draws with out of VGA memory, 16 bytes per
+ * glyph for all 256. Only valid while the adapter is in text mode */
+void vgaReadFont(byte *glyphs);
+
 #endif
\ No newline at end of file
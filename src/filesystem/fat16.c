@@ -2,8 +2,10 @@
 
 #include "../debug.h"
 #include "../libc/mem.h"
+#include "../libc/arena.h"
 #include "../libc/string.h"
 #include "../drivers/vga.h"
+#include "../kernel/pool.h"
 
 // Note to self: pretty sure this is how Fat16 works at a high level:
 
@@ -41,17 +43,81 @@ static void writeCluster(Fat16FilesystemInfo *fs, uint32_t cluster, byte *buffer
     diskWrite(fs->disk, clusterStart, bootsector->sectorsPerCluster, buffer);
 }
 
-static void clearCluster(Fat16FilesystemInfo *fs, uint32_t cluster) {
+static uint32_t clusterSector(Fat16FilesystemInfo *fs, uint32_t cluster) {
     Fat16BootSector *bootsector = &(fs->bootsector);
     uint32_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
     uint32_t dataStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT) + bootsector->rootDirCount / entriesPerSector;
-    uint32_t clusterStart = dataStart + (cluster - 2) * bootsector->sectorsPerCluster;
+    return dataStart + (cluster - 2) * bootsector->sectorsPerCluster;
+}
+
+#define CLEAR_RUN_SECTORS 64    // Most sectors zeroed by one write
+
+/* Zero new clusters from the calling thread, one write per run of consecutive
+ * clusters. Not a pool job: the disk API locks and yields, and one PIO channel
+ * would serialise the writes anyway */
+static void clearClusters(Fat16FilesystemInfo *fs, uint32_t *clusters, uint32_t count) {
+    uint32_t sectorsPerCluster = fs->bootsector.sectorsPerCluster;
+    uint32_t maxRun = CLEAR_RUN_SECTORS / sectorsPerCluster;
+    if (maxRun == 0)
+        maxRun = 1;
+    uint32_t runBytes = maxRun * sectorsPerCluster * fs->bootsector.bytesPerSector;
+    byte *zeroes = (byte *)arenaAlloc(&fs->scratch, runBytes);
+    memset(zeroes, 0, runBytes);
+
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t run = 1;
+        while (i + run < count && run < maxRun && clusters[i + run] == clusters[i] + run)
+            run++;
+        diskWrite(fs->disk, clusterSector(fs, clusters[i]), (uint8_t)(run * sectorsPerCluster), zeroes);
+        i += run;
+    }
+}
+
+// Free clusters as a bitmap, 32 to a word, so finding many of them doesn't rescan the FAT
+typedef struct {
+    uint16_t *fat;
+    uint32_t totalClusters;
+    uint32_t *words;
+    uint32_t wordCount;
+    uint32_t nextWord;      // Words before this one have no free clusters left
+} FreeMap;
+
+#define FREE_MAP_GRAIN 64   // Words per piece when building the map in parallel
+
+static void buildFreeMapRange(void *arg, uint32_t begin, uint32_t end) {
+    FreeMap *freeMap = (FreeMap *)arg;
+    for (uint32_t word = begin; word < end; word++) {
+        uint32_t bits = 0;
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            uint32_t cluster = word * 32 + bit;
+            if (cluster >= 2 && cluster < freeMap->totalClusters && freeMap->fat[cluster] == 0x0000)
+                bits |= 1u << bit;
+        }
+        freeMap->words[word] = bits;
+    }
+}
 
-    uint32_t clusterLength = bootsector->bytesPerSector*bootsector->sectorsPerCluster;
-    byte *zeroes = (byte*)malloc(clusterLength);
-    memset(zeroes, 0, clusterLength);
-    diskWrite(fs->disk, clusterStart, bootsector->sectorsPerCluster, zeroes);
-    free((void*)zeroes);
+static void buildFreeMap(Fat16FilesystemInfo *fs, uint16_t *fat, FreeMap *freeMap) {
+    Fat16BootSector *bootsector = &(fs->bootsector);
+    freeMap->fat = fat;
+    freeMap->totalClusters = bootsector->sectorsPerFAT * bootsector->bytesPerSector / 2;
+    freeMap->wordCount = (freeMap->totalClusters + 31) / 32;
+    freeMap->words = (uint32_t *)arenaAlloc(&fs->scratch, freeMap->wordCount * sizeof(uint32_t));
+    freeMap->nextWord = 0;
+    poolParallelFor(0, freeMap->wordCount, FREE_MAP_GRAIN, buildFreeMapRange, freeMap);
+}
+
+static uint32_t takeFreeCluster(FreeMap *freeMap) {
+    for (; freeMap->nextWord < freeMap->wordCount; freeMap->nextWord++) {
+        uint32_t bits = freeMap->words[freeMap->nextWord];
+        if (bits != 0) {
+            uint32_t bit = __builtin_ctz(bits);
+            freeMap->words[freeMap->nextWord] = bits & (bits - 1);
+            return freeMap->nextWord * 32 + bit;
+        }
+    }
+    return 0xFFFFFFFF;
 }
 
 static uint32_t findFreeCluster(uint16_t *fat, uint32_t totalClusters) {
@@ -78,23 +144,30 @@ static uint32_t chainLength(uint16_t *fat, uint32_t cluster) {
 }
 
 static void appendChain(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t cluster, uint32_t n) {
-    Fat16BootSector *bootsector = &(fs->bootsector);
     uint32_t endCluster = cluster;
     while (fat[endCluster] < 0xFFF8) {
         endCluster = fat[endCluster];
     }
-    for (uint32_t i = 0; i < n; i++) {
-        uint32_t newCluster = findFreeCluster(fat, bootsector->sectorsPerFAT * bootsector->bytesPerSector / 2);
+
+    ArenaMark mark = arenaPush(&fs->scratch);
+    FreeMap freeMap;
+    buildFreeMap(fs, fat, &freeMap);
+    uint32_t *newClusters = (uint32_t *)arenaAlloc(&fs->scratch, n * sizeof(uint32_t));
+    uint32_t count = 0;
+    for (; count < n; count++) {
+        uint32_t newCluster = takeFreeCluster(&freeMap);
         if (newCluster == 0xFFFFFFFF) {
-            return;
+            break;
         }
-        vgaWrite("new index: "); vgaWriteInt((uint16_t)newCluster); vgaNextLine();
+        LOG_DEBUG(LOG_CAT_FS, "Appending cluster %u", newCluster);
         fat[endCluster] = (uint16_t)newCluster;
-        fat[newCluster] = (i == n - 1) ? 0xFFFF : (uint16_t)(newCluster + 1);
-
-        clearCluster(fs, newCluster);
+        fat[newCluster] = 0xFFFF;
+        newClusters[count] = newCluster;
         endCluster = newCluster;
     }
+
+    clearClusters(fs, newClusters, count);
+    arenaPop(&fs->scratch, mark);
 }
 
 static void popChain(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t cluster, uint32_t n) {
@@ -145,7 +218,8 @@ static uint32_t fitChainToBytes(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t
 static void readChain(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t cluster, byte *buffer, uint32_t nbytes) {
     Fat16BootSector *bootsector = &(fs->bootsector);
     uint32_t bufferOffset = 0;
-    byte *bufferTmp = (byte*)malloc(bootsector->sectorsPerCluster * bootsector->bytesPerSector);
+    ArenaMark mark = arenaPush(&fs->scratch);
+    byte *bufferTmp = (byte*)arenaAlloc(&fs->scratch, bootsector->sectorsPerCluster * bootsector->bytesPerSector);
     
     while (cluster < 0xFFF8 && nbytes > 0) {
         uint32_t bytesToRead = nbytes < (bootsector->sectorsPerCluster * bootsector->bytesPerSector) ?
@@ -158,7 +232,7 @@ static void readChain(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t cluster,
 
         cluster = fat[cluster];
     }
-    free((void*)bufferTmp);
+    arenaPop(&fs->scratch, mark);
 }
 
 static void writeChain(Fat16FilesystemInfo *fs, uint16_t *fat, uint32_t cluster, byte *buffer, uint32_t nbytes) {
@@ -187,6 +261,20 @@ static void readBootsector(Fat16FilesystemInfo *fs) {
     diskRead(fs->disk, 0, 1, (byte*) bootsector);
 }
 
+// Read the FAT and the root directory into the scratch arena
+static void loadRoot(Fat16FilesystemInfo *fs, uint16_t **fat, Fat16DirectoryEntry **dir, uint32_t *entryCount) {
+    Fat16BootSector *bootsector = &(fs->bootsector);
+    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
+    *fat = (uint16_t*)arenaAlloc(&fs->scratch, fatBytes);
+    readFAT(fs, *fat);
+
+    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
+    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
+    *entryCount = bootsector->rootDirCount;
+    *dir = (Fat16DirectoryEntry*)arenaAlloc(&fs->scratch, *entryCount * sizeof(Fat16DirectoryEntry));
+    diskRead(fs->disk, rootDirStart, *entryCount / entriesPerSector, (byte*)*dir);
+}
+
 static inline bool entryIsAvailable(Fat16DirectoryEntry *entry) {
     return entry->fileName[0] == 0x00 || entry->fileName[0] == 0xE5;
 }
@@ -293,9 +381,10 @@ static void convertFilename83ToRegular(char *name83, char *dst) {
 
 static bool traversePath(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEntry **dir, uint32_t *parentDirCluster, uint32_t *dirCluster, uint32_t *entryCount, char **path) {
     char name[9];
+    char *slash;
     int i, dirIdx;
 
-    while (strcontains(*path, '/')) {
+    while ((slash = strchr(*path, '/')) != NULL) {
         i = 0;
         for (; i < 8; i++) {
             if ((*path)[i] == '/') break;
@@ -305,7 +394,7 @@ static bool traversePath(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryE
             name[i] = ' ';
         }
         name[8] = '\0';
-        *path = strchr(*path, '/') + 1;
+        *path = slash + 1;
         //vgaWrite("Entering directory: "); vgaWriteStatic(name, 8); vgaNextLine();
         if (name[0] == 0xE5)
             name[0] = 0x05;
@@ -327,8 +416,10 @@ static bool traversePath(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryE
         }
         uint16_t newDirCluster = (*dir)[i].firstCluster;
         uint32_t bytes = chainLength(fat, newDirCluster) * (uint32_t)fs->bootsector.bytesPerSector * (uint32_t)fs->bootsector.sectorsPerCluster;
-        free((void*)*dir);
-        *dir = (Fat16DirectoryEntry*)malloc(bytes);
+        // Reuse the current directory's buffer when the subdirectory fits in it,
+        // otherwise the old one is released with the rest of the operation's scratch memory
+        if (bytes > *entryCount * sizeof(Fat16DirectoryEntry))
+            *dir = (Fat16DirectoryEntry*)arenaAlloc(&fs->scratch, bytes);
         readChain(fs, fat, newDirCluster, (byte*)*dir, bytes);
         *parentDirCluster = *dirCluster;
         *dirCluster = newDirCluster;
@@ -361,7 +452,7 @@ static bool createDirectory(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16Directo
         if (entryIsDirectory(&((*dir)[i])))
         {
             if (strequal_nocase((*dir)[i].fileName, name, 8)) {
-                vgaWriteln("Directory already exists");
+                LOG_DEBUG(LOG_CAT_FS, "Directory already exists");
                 return false;
             }
         }
@@ -377,7 +468,7 @@ static bool createDirectory(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16Directo
     }
     if (dirIdx < 0)
     {
-        vgaWriteln("No free entries");
+        LOG_WARN(LOG_CAT_FS, "No free directory entries");
         return false;
     }
     uint16_t cluster = dirCluster;
@@ -443,7 +534,7 @@ static bool createFile(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEnt
     for (; i < entryCount; i++) {
         if (!entryIsDirectory(&((*dir)[i]))) {
             if (strequal_nocase((*dir)[i].fileName, name, 8)) {
-                vgaWriteln("File already exists");
+                LOG_DEBUG(LOG_CAT_FS, "File already exists");
                 return false;
             }
         }
@@ -459,7 +550,7 @@ static bool createFile(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEnt
     }
 
     if (dirIdx < 0) {
-        vgaWriteln("No free entries");
+        LOG_WARN(LOG_CAT_FS, "No free directory entries");
         return false;
     }
     uint16_t cluster = (uint16_t)findFreeCluster(fat, fatBytes / 2);
@@ -612,7 +703,7 @@ static bool readFile(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEntry
         }
     }
     if (dirIdx < 0) {
-        vgaWriteln("File does not exist");
+        LOG_WARN(LOG_CAT_FS, "File does not exist");
         return false;
     }
 
@@ -673,10 +764,9 @@ static bool writeFile(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEntr
         }
     }
     if (dirIdx < 0) {
-        vgaWriteln("File does not exist");
+        LOG_WARN(LOG_CAT_FS, "File does not exist");
         return false;
     }
-    vgaWriteStatic((*dir)[dirIdx].fileName, 8); vgaNextLine();
     uint16_t cluster = (uint16_t)(*dir)[dirIdx].firstCluster;
     fitChainToBytes(fs, fat, cluster, nbytes);
     writeChain(fs, fat, cluster, buffer, nbytes);
@@ -693,40 +783,24 @@ static bool writeFile(Fat16FilesystemInfo *fs, uint16_t *fat, Fat16DirectoryEntr
 
 static bool fat16CreateDirectorySingle(Fat16FilesystemInfo *fs, char *path) {
     if (path[0] == '/') path++;
-    Fat16BootSector *bootsector = &(fs->bootsector);
-    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
-    uint16_t *fat = (uint16_t*)malloc(fatBytes);
-    readFAT(fs, fat);
-    // load root directory
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry*)malloc(bootsector->rootDirCount * sizeof(Fat16DirectoryEntry));
-    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
-
-    uint32_t entryCount = bootsector->rootDirCount;
-    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
-    uint8_t sectors = entryCount / entriesPerSector;
+    ArenaMark mark = arenaPush(&fs->scratch);
+    uint16_t *fat;
+    Fat16DirectoryEntry *dir;
+    uint32_t entryCount;
     uint32_t dirCluster = 0;
     uint32_t parentDirCluster = 0;
-    diskRead(fs->disk, rootDirStart, sectors, (byte*)dir);
-
-    if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path))
-    {
-        vgaWriteln("Path does not exist");
-        free((void*)fat);
-        free((void*)dir);
-        return false;
-    }
+    loadRoot(fs, &fat, &dir, &entryCount);
 
-    if (!createDirectory(fs, fat, &dir, parentDirCluster, dirCluster, entryCount, path)) {
-        free((void*)fat);
-        free((void*)dir);
-        return false;
+    bool ok = false;
+    if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path)) {
+        LOG_WARN(LOG_CAT_FS, "Path does not exist");
+    } else if (createDirectory(fs, fat, &dir, parentDirCluster, dirCluster, entryCount, path)) {
+        writeFAT(fs, fat);
+        ok = true;
     }
 
-    writeFAT(fs, fat);
-
-    free((void*)fat);
-    free((void*)dir);
-    return true;
+    arenaPop(&fs->scratch, mark);
+    return ok;
 }
 
 bool fat16Setup(DiskInfo *diskInfo, Fat16FilesystemInfo *fs) {
@@ -734,16 +808,22 @@ bool fat16Setup(DiskInfo *diskInfo, Fat16FilesystemInfo *fs) {
     fs->disk = diskInfo;
     readBootsector(fs);
 
+    // Enough for the FAT, the root directory and a few directory chains,
+    // deeper paths overflow into extra chunks
+    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
+    uint32_t rootDirBytes = bootsector->rootDirCount * sizeof(Fat16DirectoryEntry);
+    arenaInit(&fs->scratch, fatBytes + rootDirBytes + FAT16_SCRATCH_EXTRA_BYTES);
+
     uint32_t firstFAT = bootsector->reservedSectors;
-    byte *fatSector1 = (byte*) malloc(512);
+    byte *fatSector1 = (byte*) arenaAlloc(&fs->scratch, 512);
     diskRead(diskInfo, firstFAT, 1, fatSector1);
 
     bool initialized = fatSector1[0] == bootsector->mediaDescriptorType;
     bool wasOk = true;
     if(initialized) {
-        LOG("FAT16 is already ok\n");
+        LOG_INFO(LOG_CAT_FS, "FAT16 is already ok");
     } else {
-        LOG("FAT16 is not ok, setting up...\n");
+        LOG_WARN(LOG_CAT_FS, "FAT16 is not ok, setting up...");
         fatSector1[0] = bootsector->mediaDescriptorType;
         fatSector1[1] = 0xFF;
         fatSector1[2] = 0xFF;
@@ -751,19 +831,17 @@ bool fat16Setup(DiskInfo *diskInfo, Fat16FilesystemInfo *fs) {
         diskWrite(diskInfo, firstFAT, 1, fatSector1);
         wasOk = false;
     }
-    free((void*)fatSector1);
+    arenaReset(&fs->scratch);
     fat16CreateDirectorySingle(fs, ".");
     fat16CreateDirectorySingle(fs, "..");
     return wasOk;
 }
 
 bool fat16CreateDirectory(Fat16FilesystemInfo *fs, char *path) {
-    vgaWrite("Creating directory `");
-    vgaWrite(path);
-    vgaWrite("`... ");
     if (!fat16CreateDirectorySingle(fs, path)) return false;
     int len = strlen(path);
-    char *pathLoopback = (char*)malloc(len+4);
+    ArenaMark mark = arenaPush(&fs->scratch);
+    char *pathLoopback = (char*)arenaAlloc(&fs->scratch, len+4);
     memcpy(path, pathLoopback, len);
     pathLoopback[len] = '/';
     pathLoopback[len+1] = '.';
@@ -772,135 +850,78 @@ bool fat16CreateDirectory(Fat16FilesystemInfo *fs, char *path) {
     pathLoopback[len+2] = '.';
     pathLoopback[len+3] = '\0';
     fat16CreateDirectorySingle(fs, pathLoopback);
-    free((void*)pathLoopback);
-    vgaWriteln("OK");
+    arenaPop(&fs->scratch, mark);
+    LOG_DEBUG(LOG_CAT_FS, "Created a directory");
     return true;
 }
 
 bool fat16CreateFile(Fat16FilesystemInfo *fs, char *path) {
-    vgaWrite("Creating file `");
-    vgaWrite(path);
-    vgaWrite("`... ");
     if (path[0] == '/') path++;
-    Fat16BootSector *bootsector = &(fs->bootsector);
-    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
-    uint16_t *fat = (uint16_t*)malloc(fatBytes);
-    readFAT(fs, fat);
-
-    // Load root directory
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry*)malloc(bootsector->rootDirCount * sizeof(Fat16DirectoryEntry));
-    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
-
-    uint32_t entryCount = bootsector->rootDirCount;
-    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
-    uint8_t sectors = entryCount / entriesPerSector;
+    ArenaMark mark = arenaPush(&fs->scratch);
+    uint16_t *fat;
+    Fat16DirectoryEntry *dir;
+    uint32_t entryCount;
     uint32_t dirCluster = 0;
     uint32_t parentDirCluster = 0;
-    diskRead(fs->disk, rootDirStart, sectors, (byte*)dir);
+    loadRoot(fs, &fat, &dir, &entryCount);
 
+    bool ok = false;
     if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path)) {
-        vgaWriteln("Path does not exist");
-        free((void*)fat);
-        free((void*)dir);
-        return false;
+        LOG_WARN(LOG_CAT_FS, "Path does not exist");
+    } else if (createFile(fs, fat, &dir, dirCluster, entryCount, path)) {
+        writeFAT(fs, fat);
+        LOG_DEBUG(LOG_CAT_FS, "Created a file");
+        ok = true;
     }
 
-    if (!createFile(fs, fat, &dir, dirCluster, entryCount, path)) {
-        free((void*)fat);
-        free((void*)dir);
-        return false;
-    }
-
-    writeFAT(fs, fat);
-
-    free((void*)fat);
-    free((void*)dir);
-    vgaWriteln("OK");
-    return true;
+    arenaPop(&fs->scratch, mark);
+    return ok;
 }
 
 bool fat16WriteFile(Fat16FilesystemInfo *fs, char *path, byte *buffer, uint32_t nbytes) {
-    vgaWrite("Writing to file `");
-    vgaWrite(path);
-    vgaWrite("`... ");
     if (path[0] == '/') path++;
-    Fat16BootSector *bootsector = &(fs->bootsector);
-    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
-    uint16_t *fat = (uint16_t*)malloc(fatBytes);
-    readFAT(fs, fat);
-
-    // Load root directory
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry*)malloc(bootsector->rootDirCount * sizeof(Fat16DirectoryEntry));
-    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
-
-    uint32_t entryCount = bootsector->rootDirCount;
-    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
-    uint8_t sectors = entryCount / entriesPerSector;
+    ArenaMark mark = arenaPush(&fs->scratch);
+    uint16_t *fat;
+    Fat16DirectoryEntry *dir;
+    uint32_t entryCount;
     uint32_t dirCluster = 0;
     uint32_t parentDirCluster = 0;
-    diskRead(fs->disk, rootDirStart, sectors, (byte*)dir);
+    loadRoot(fs, &fat, &dir, &entryCount);
 
+    bool ok = false;
     if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path)) {
-        vgaWriteln("Path does not exist");
-        free((void*)fat);
-        free((void*)dir);
-        return false;
+        LOG_WARN(LOG_CAT_FS, "Path does not exist");
+    } else if (writeFile(fs, fat, &dir, dirCluster, entryCount, path, buffer, nbytes)) {
+        writeFAT(fs, fat);
+        LOG_DEBUG(LOG_CAT_FS, "Wrote %u bytes", nbytes);
+        ok = true;
     }
 
-    if (!writeFile(fs, fat, &dir, dirCluster, entryCount, path, buffer, nbytes)) {
-        free((void*)fat);
-        free((void*)dir);
-        return false;
-    }
-
-    writeFAT(fs, fat);
-
-    free((void*)fat);
-    free((void*)dir);
-    vgaWriteln("OK");
-    return true;
+    arenaPop(&fs->scratch, mark);
+    return ok;
 }
 
 bool fat16ReadFile(Fat16FilesystemInfo *fs, char *path, byte *buffer, uint32_t nbytes) {
-    vgaWrite("Reading file `");
-    vgaWrite(path);
-    vgaWrite("`... ");
     if (path[0] == '/') path++;
-    Fat16BootSector *bootsector = &(fs->bootsector);
-    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
-    uint16_t *fat = (uint16_t*)malloc(fatBytes);
-    readFAT(fs, fat);
-
-    // Load root directory
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry*)malloc(bootsector->rootDirCount * sizeof(Fat16DirectoryEntry));
-    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
-
-    uint32_t entryCount = bootsector->rootDirCount;
-    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
-    uint8_t sectors = entryCount / entriesPerSector;
+    ArenaMark mark = arenaPush(&fs->scratch);
+    uint16_t *fat;
+    Fat16DirectoryEntry *dir;
+    uint32_t entryCount;
     uint32_t dirCluster = 0;
     uint32_t parentDirCluster = 0;
-    diskRead(fs->disk, rootDirStart, sectors, (byte*)dir);
+    loadRoot(fs, &fat, &dir, &entryCount);
 
+    bool ok = false;
     if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path)) {
-        vgaWriteln("Path does not exist");
-        free((void*)fat);
-        free((void*)dir);
-        return false;
-    }
-    if (!readFile(fs, fat, &dir, dirCluster, entryCount, path, buffer, nbytes)) {
-        free((void*)fat);
-        free((void*)dir);
-        return false;
+        LOG_WARN(LOG_CAT_FS, "Path does not exist");
+    } else if (readFile(fs, fat, &dir, dirCluster, entryCount, path, buffer, nbytes)) {
+        writeFAT(fs, fat);
+        LOG_DEBUG(LOG_CAT_FS, "Read up to %u bytes", nbytes);
+        ok = true;
     }
-    
-    writeFAT(fs, fat);
-    
 
-    free((void*)fat);
-    free((void*)dir);
-    vgaWriteln("OK");
-    return true;
+    arenaPop(&fs->scratch, mark);
+    return ok;
 }
 
 bool fat16PathExists(Fat16FilesystemInfo *fs, char *path) {
@@ -908,41 +929,20 @@ bool fat16PathExists(Fat16FilesystemInfo *fs, char *path) {
     //vgaWrite(path);
     //vgaWrite("`... ");
     if (path[0] == '/') path++;
-    Fat16BootSector *bootsector = &(fs->bootsector);
-    uint32_t fatBytes = bootsector->bytesPerSector * bootsector->sectorsPerFAT;
-    uint16_t *fat = (uint16_t*)malloc(fatBytes);
-    readFAT(fs, fat);
-
-    // Load root directory
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry*)malloc(bootsector->rootDirCount * sizeof(Fat16DirectoryEntry));
-    uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
-
-    uint32_t entryCount = bootsector->rootDirCount;
-    uint8_t entriesPerSector = bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry);
-    uint8_t sectors = entryCount / entriesPerSector;
+    ArenaMark mark = arenaPush(&fs->scratch);
+    uint16_t *fat;
+    Fat16DirectoryEntry *dir;
+    uint32_t entryCount;
     uint32_t dirCluster = 0;
     uint32_t parentDirCluster = 0;
-    diskRead(fs->disk, rootDirStart, sectors, (byte*)dir);
+    loadRoot(fs, &fat, &dir, &entryCount);
 
-    if (!traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path)) {
-        free((void*)fat);
-        free((void*)dir);
-        return false;
-    }
-    if (fileExists(fs, fat, &dir, dirCluster, entryCount, path)) {
-        free((void*)fat);
-        free((void*)dir);
-        return true;
-    }
-    if (dirExists(fs, fat, &dir, dirCluster, entryCount, path)) {
-        free((void*)fat);
-        free((void*)dir);
-        return true;
-    }
-    
-    free((void*)fat);
-    free((void*)dir);
-    return false;
+    bool exists = traversePath(fs, fat, &dir, &parentDirCluster, &dirCluster, &entryCount, &path) &&
+                  (fileExists(fs, fat, &dir, dirCluster, entryCount, path) ||
+                   dirExists(fs, fat, &dir, dirCluster, entryCount, path));
+
+    arenaPop(&fs->scratch, mark);
+    return exists;
 }
 
 void printRootDirectory(Fat16FilesystemInfo *fs) {
@@ -950,7 +950,8 @@ void printRootDirectory(Fat16FilesystemInfo *fs) {
     uint32_t rootDirStart = bootsector->reservedSectors + (bootsector->fatCount * bootsector->sectorsPerFAT);
     uint32_t entryCount = bootsector->rootDirCount;
 
-    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry *)malloc(entryCount * sizeof(Fat16DirectoryEntry));
+    ArenaMark mark = arenaPush(&fs->scratch);
+    Fat16DirectoryEntry *dir = (Fat16DirectoryEntry *)arenaAlloc(&fs->scratch, entryCount * sizeof(Fat16DirectoryEntry));
     diskRead(fs->disk, rootDirStart, entryCount / (bootsector->bytesPerSector / sizeof(Fat16DirectoryEntry)), (byte *)dir);
     char filename[13];
     char filename83[12];
@@ -965,5 +966,5 @@ void printRootDirectory(Fat16FilesystemInfo *fs) {
         }
     }
 
-    free((void *)dir);
+    arenaPop(&fs->scratch, mark);
 }
\ No newline at end of file
@@ -2,11 +2,15 @@
 #define FAT16_H
 
 #include "../drivers/disk.h"
+#include "../libc/arena.h"
 
 #include "../types.h"
 
 #define FAT16_EntryBytes 32
 
+// Scratch arena space on top of the FAT and root directory, for directory chains and cluster buffers
+#define FAT16_SCRATCH_EXTRA_BYTES 0x8000
+
 #define FAT16_FLAG_READONLY 0x01
 #define FAT16_FLAG_HIDDEN 0x02
 #define FAT16_FLAG_SYSTEM 0x04
@@ -56,6 +60,7 @@ typedef struct {
 typedef struct {
     DiskInfo *disk;
     Fat16BootSector bootsector;
+    Arena scratch;      // Per-operation temporaries, released when each fat16* call returns
 } Fat16FilesystemInfo;
 
 bool fat16Setup(DiskInfo *disk, Fat16FilesystemInfo *fs);
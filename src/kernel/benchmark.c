@@ -0,0 +1,59 @@
+#include "benchmark.h"
+
+#include "../libc/mem.h"
+#include "../cpu/timer.h"
+#include "../libc/printf.h"
+#include "../drivers/vga.h"
+
+#define BENCH_MAX_SIZE 32768
+#define BENCH_BYTES_PER_RUN (256 * 1024)
+
+// Print bytes/cycle with two decimals, no FPU needed
+static void printRate(char *name, uint32_t size, uint32_t bytes, uint32_t cycles) {
+    if (cycles == 0)
+        cycles = 1;
+    uint32_t hundredths = (bytes / cycles) * 100 + ((bytes % cycles) * 100) / cycles;
+
+    kprintf("%s %uB: %u.%02u B/cycle\n", name, size, hundredths / 100, hundredths % 100);
+}
+
+void memBenchmark() {
+    static const uint32_t sizes[] = { 8, 64, 256, 1024, 4096, BENCH_MAX_SIZE };
+    char *a = (char *)malloc(BENCH_MAX_SIZE);
+    char *b = (char *)malloc(BENCH_MAX_SIZE);
+    memset(a, 0x5A, BENCH_MAX_SIZE);
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t size = sizes[s];
+        uint32_t iterations = BENCH_BYTES_PER_RUN / size;
+        uint64_t start;
+        uint32_t cycles;
+
+        start = cyclesStart();
+        for (uint32_t i = 0; i < iterations; i++)
+            memcpy(a, b, size);
+        cycles = (uint32_t)cyclesStop(start);
+        printRate("memcpy  ", size, iterations * size, cycles);
+
+        start = cyclesStart();
+        for (uint32_t i = 0; i < iterations; i++)
+            memset(b, (char)i, size);
+        cycles = (uint32_t)cyclesStop(start);
+        printRate("memset  ", size, iterations * size, cycles);
+
+        memcpy(a, b, size);
+        start = cyclesStart();
+        for (uint32_t i = 0; i < iterations; i++)
+            memequal(a, b, size);
+        cycles = (uint32_t)cyclesStop(start);
+        printRate("memequal", size, iterations * size, cycles);
+    }
+
+    free((void *)a);
+    free((void *)b);
+}
+
+void runBenchmarks() {
+    vgaWriteln("Running benchmarks...");
+    memBenchmark();
+}
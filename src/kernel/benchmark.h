@@ -0,0 +1,12 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "../types.h"
+
+/* Measure memcpy/memset/memequal throughput and print bytes/cycle per size class */
+void memBenchmark();
+
+/* Run every benchmark, enabled by building with CFLAGS=-DBENCHMARK */
+void runBenchmarks();
+
+#endif // BENCHMARK_H
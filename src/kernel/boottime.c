@@ -0,0 +1,105 @@
+#include "boottime.h"
+
+#include "../cpu/timer.h"
+#include "../cpu/utils.h"
+#include "../drivers/disk.h"
+#include "../drivers/serial.h"
+#include "../libc/printf.h"
+
+#define KERNEL_OFFSET     0x1000
+#define LOADER_CHUNK      64        // Sectors per extended read in boot/disk16.asm
+
+typedef struct {
+    const char *name;
+    uint64_t start;         // TSC
+    DiskStats disk;         // Totals when it started
+} BootPhase;
+
+extern char _edata[];       // From the linker, the image the boot sector reads ends here
+
+static BootPhase phases[BOOT_MAX_PHASES];
+static uint32_t phaseCount = 0;
+static uint64_t loaderStamp = 0;
+static uint64_t entryStamp = 0;
+static DiskStats noDisk;
+
+void bootPhase(const char *name) {
+    if (phaseCount == 0) {
+        // Copied while low memory is still as the loaders left it
+        loaderStamp = *(volatile uint64_t *)BOOT_STAMP_LOADER;
+        entryStamp = *(volatile uint64_t *)BOOT_STAMP_ENTRY;
+    }
+    if (phaseCount == BOOT_MAX_PHASES)
+        return;
+    BootPhase *phase = &phases[phaseCount++];
+    phase->name = name;
+    diskGetStats(&phase->disk);
+    phase->start = readTSC();
+}
+
+// Milliseconds with three decimals, as two numbers
+static uint32_t milliseconds(uint64_t cycles, uint32_t *micros) {
+    uint64_t us = udiv64(cyclesToNanoseconds(cycles), 1000, NULL);
+    return (uint32_t)udiv64(us, 1000, micros);
+}
+
+// snprintf returns the length it wanted, keep appending at the terminator once the line is full
+static uint32_t clampLength(uint32_t length, uint32_t size) {
+    return length < size ? length : size - 1;
+}
+
+static void printPhase(const char *name, uint64_t start, uint64_t end, DiskStats *from, DiskStats *to) {
+    char line[PRINTF_LINE_LENGTH];
+    uint32_t micros;
+    uint32_t ms = milliseconds(end - start, &micros);
+    uint32_t length = clampLength(snprintf(line, sizeof(line), "  %-14s %6u.%03u ms", name, ms, micros), sizeof(line));
+    const char *separator = "  ";
+    if (to->reads != from->reads || to->writes != from->writes) {
+        length += snprintf(line + length, sizeof(line) - length, "%s%u reads %u sectors, %u writes %u sectors", separator,
+                           to->reads - from->reads, to->sectorsRead - from->sectorsRead,
+                           to->writes - from->writes, to->sectorsWritten - from->sectorsWritten);
+        length = clampLength(length, sizeof(line));
+        separator = ", ";
+    }
+    if (to->cachedReads != from->cachedReads) {
+        length += snprintf(line + length, sizeof(line) - length, "%s%u reads from the cache", separator,
+                           to->cachedReads - from->cachedReads);
+        length = clampLength(length, sizeof(line));
+        separator = ", ";
+    }
+    if (to->cycles != from->cycles) {
+        ms = milliseconds(to->cycles - from->cycles, &micros);
+        length += snprintf(line + length, sizeof(line) - length, "%s%u.%03u ms on disk", separator, ms, micros);
+        length = clampLength(length, sizeof(line));
+    }
+    serialPrintf("%s\n", line);
+}
+
+void bootReport() {
+    uint64_t end = readTSC();
+    DiskStats now;
+    diskGetStats(&now);
+
+    uint32_t micros;
+    uint32_t ms = milliseconds(end, &micros);
+    serialPrintf("Boot profile, %u.%03u ms since reset:\n", ms, micros);
+
+    // Before the kernel there was no disk driver to count, the boot sector's reads are known though
+    if (loaderStamp != 0 && loaderStamp < entryStamp) {
+        DiskStats loader = noDisk;
+        loader.sectorsRead = ((uint32_t)_edata - KERNEL_OFFSET + 511) / 512;
+        loader.reads = (loader.sectorsRead + LOADER_CHUNK - 1) / LOADER_CHUNK;
+        printPhase("firmware", 0, loaderStamp, &noDisk, &noDisk);
+        printPhase("boot sector", loaderStamp, entryStamp, &noDisk, &loader);
+    } else {
+        printPhase("firmware+loader", 0, entryStamp, &noDisk, &noDisk);
+    }
+    if (phaseCount == 0)
+        return;
+    printPhase("kernel entry", entryStamp, phases[0].start, &noDisk, &noDisk);
+    for (uint32_t i = 0; i < phaseCount; i++) {
+        bool last = i + 1 == phaseCount;
+        printPhase(phases[i].name, phases[i].start, last ? end : phases[i + 1].start,
+                   &phases[i].disk, last ? &now : &phases[i + 1].disk);
+    }
+}
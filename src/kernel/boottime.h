@@ -0,0 +1,25 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include "../types.h"
+
+/* Boot phase timing. The boot sector and kernel_entry.asm leave TSC stamps in
+ * low memory, main marks where each of its phases starts with bootPhase, and
+ * bootReport prints over serial how long every phase took and the disk
+ * transfers it made, from the boot sector on. The TSC counts from reset, so the
+ * first line is the firmware's time.
+ *
+ * Stamps are taken before the TSC is calibrated and converted in the report,
+ * without a TSC every phase reads 0. */
+
+#define BOOT_STAMP_LOADER 0x0500    // TSC when the boot sector started, 0 after a Multiboot loader
+#define BOOT_STAMP_ENTRY  0x0508    // TSC when kernel_entry.asm started
+#define BOOT_MAX_PHASES   24
+
+/* End the current phase and start one called `name`, a static string */
+void bootPhase(const char *name);
+
+/* End the current phase and print the report. Call after init_timer */
+void bootReport();
+
+#endif // BOOTTIME_H
@@ -0,0 +1,54 @@
+#include "deferred.h"
+
+#include "thread.h"
+#include "../cpu/utils.h"
+
+// Work waiting to run, in the order it was scheduled. IRQs only reach the boot
+// CPU, so disabling interrupts is enough to guard it
+static DeferredWork *queuedHead = NULL;
+static DeferredWork *queuedTail = NULL;
+static Thread *deferredThread = NULL;
+
+static void deferredLoop(void *arg) {
+    while (true) {
+        uint32_t flags = irqSave();
+        while (queuedHead == NULL)
+            threadBlock();
+        DeferredWork *work = queuedHead;
+        queuedHead = work->next;
+        if (queuedHead == NULL)
+            queuedTail = NULL;
+        // Cleared before running, so an IRQ during the function queues it again
+        work->queued = false;
+        irqRestore(flags);
+
+        work->function(work->arg);
+    }
+}
+
+void deferredInit() {
+    deferredThread = threadCreate("deferred", deferredLoop, NULL, THREAD_PRIORITY_HIGH);
+}
+
+void deferredWorkInit(DeferredWork *work, DeferredFunction function, void *arg) {
+    work->function = function;
+    work->arg = arg;
+    work->queued = false;
+    work->next = NULL;
+}
+
+void deferredSchedule(DeferredWork *work) {
+    uint32_t flags = irqSave();
+    if (!work->queued) {
+        work->queued = true;
+        work->next = NULL;
+        if (queuedTail)
+            queuedTail->next = work;
+        else
+            queuedHead = work;
+        queuedTail = work;
+        if (deferredThread)
+            threadWake(deferredThread);
+    }
+    irqRestore(flags);
+}
@@ -0,0 +1,38 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include "../types.h"
+
+/* Deferred interrupt work (bottom halves). An IRQ handler should only grab the
+ * hardware state, usually into an SpscRing, and schedule its DeferredWork; the
+ * function then runs on the high priority "deferred" thread with interrupts
+ * enabled, right after the IRQ unless a higher priority thread is running.
+ *
+ * Scheduling work that is already queued does nothing, so the function should
+ * drain everything its handler left behind.
+ *
+ * The keyboard is the only user. Timer callbacks stay in the timer interrupt:
+ * each one wakes a thread or a task, ends a time slice or samples the
+ * interrupted frame for the profiler, a few list operations that have to be
+ * done before the interrupt returns for the scheduler to act on them. The ATA
+ * driver is PIO and polls the status port, with IRQ 14 and 15 left unhandled,
+ * so the disk has no interrupt work to defer. */
+
+typedef void (*DeferredFunction)(void *arg);
+
+typedef struct DeferredWork {
+    DeferredFunction function;
+    void *arg;
+    volatile bool queued;
+    struct DeferredWork *next;
+} DeferredWork;
+
+/* Start the deferred thread. Call after threadInit */
+void deferredInit();
+
+void deferredWorkInit(DeferredWork *work, DeferredFunction function, void *arg);
+
+/* Queue the work to run soon, safe to call from IRQs */
+void deferredSchedule(DeferredWork *work);
+
+#endif // DEFERRED_H
@@ -2,14 +2,29 @@
 #include "../cpu/idt.h"
 #include "../cpu/utils.h"
 #include "../cpu/timer.h"
+#include "../cpu/fpu.h"
+#include "../cpu/smp.h"
 #include "../drivers/keyboard.h"
 #include "../libc/stream.h"
 #include "../libc/mem.h"
+#include "../libc/printf.h"
 #include "../drivers/vga.h"
 #include "../drivers/disk.h"
 #include "../drivers/ports.h"
+#include "../drivers/serial.h"
+#include "../drivers/fbconsole.h"
 #include "../filesystem/filesystem.h"
 #include "../filesystem/fat16.h"
+#include "benchmark.h"
+#include "thread.h"
+#include "task.h"
+#include "pool.h"
+#include "deferred.h"
+#include "profiler.h"
+#include "log.h"
+#include "multiboot.h"
+#include "boottime.h"
+#include "readahead.h"
 
 #include "../types.h"
 
@@ -20,42 +35,96 @@ void reboot()
     while (good & 0x02)
         good = portByteIn(0x64);
     portByteOut(0x64, 0xFE);
-    uint64_t target = getTicksSinceBoot() + 200;
-    while (getTicksSinceBoot() < target);
+    timerSleep(400);
     halt();
 }
 
-void doubleFaultHandler(registers_t r) {
+void doubleFaultHandler(registers_t *r) {
+    serialSetPolled();
+    logFlush();
+    serialWrite("WARNING: DOUBLE FAULT\n");
     vgaWriteln("WARNING: DOUBLE FAULT");
     while(1);
 }
 
 void main() {
+    bootPhase("cpu");
+    smpInitBoot();
+    multibootInit();
+    serialInit();
+    bootPhase("interrupts");
     isr_install();
+    serialInitInterrupts();
+    init_fpu();
+    bootPhase("threads");
+    threadInit();
+    deferredInit();
+    logInit();
+    if (multibootHasOption("log=console"))
+        logSetSinks(LOG_SINK_CONSOLE);
 
+    bootPhase("timer");
     asm volatile("sti");
-    init_timer(500);
+    init_timer(1000);
+    serialPrintf("TSC runs at %u kHz\n", getTSCFrequencyKHz());
+#ifdef PROFILE
+    profilerStart(1);
+#endif
+    bootPhase("smp");
+    smpInit();
+    poolInit();
 
+    bootPhase("keyboard");
     init_keyboard();
 
     register_interrupt_handler(8, doubleFaultHandler);
 
+    bootPhase("console");
+#ifdef FRAMEBUFFER
+    if (!fbconInit(FBCON_WIDTH, FBCON_HEIGHT))
+        serialWrite("No Bochs VBE adapter, staying in text mode\n");
+#endif
     vgaClear();
     vgaWriteln("Booted successfully");
 
+#ifdef BENCHMARK
+    bootPhase("benchmarks");
+    runBenchmarks();
+#endif
+
+    bootPhase("disk");
     DiskInfo diskInfo;
     diskGetATAPIO(0, &diskInfo);
+    bootPhase("fat16");
     Fat16FilesystemInfo fat16info;
     fat16Setup(&diskInfo, &fat16info);
     FSInfo fs;
     fsInit(&fs, (void*)(&fat16info), FILESYSTEM_BACKEND_FAT16);
+    bootPhase("readahead");
+    readaheadStart(&diskInfo, &fs);
+    bootPhase("directories");
     fsCreateDirectory(&fs, "/system");
     if (!fsPathExists(&fs, "/system/boot.cfg")) reboot();
 
+    bootPhase("boot.cfg");
     char file[257];
     fsReadFile(&fs, "/system/boot.cfg", file, 256);
+    bootPhase("profile");
+    readaheadFinish(&fs);
+    bootReport();
 
     vgaNextLine();
     vgaWriteln(file);
     vgaNextLine();
+
+    logFlush();
+    memDumpStats();
+    interruptStatsDump();
+#ifdef PROFILE
+    profilerStop();
+    profilerReport();
+#endif
+
+    // From here on the kernel is driven by tasks waiting for interrupts and the disk
+    taskRunLoop();
 }
\ No newline at end of file
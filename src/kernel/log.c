@@ -0,0 +1,161 @@
+#include "log.h"
+
+#include "thread.h"
+#include "../cpu/atomic.h"
+#include "../cpu/smp.h"
+#include "../cpu/spinlock.h"
+#include "../cpu/timer.h"
+#include "../cpu/utils.h"
+#include "../drivers/serial.h"
+#include "../drivers/vga.h"
+#include "../libc/printf.h"
+
+#define LOG_RING_MASK   (LOG_RING_SIZE - 1)
+#define LOG_LINE_LENGTH 160
+
+typedef struct {
+    /* Whose turn the slot is, relative to the slot's index so that the zeroed
+     * ring starts out empty. For the record at `position` it holds
+     * `position & ~LOG_RING_MASK` while free and one more once written */
+    volatile uint32_t sequence;
+    uint8_t level;
+    uint8_t category;
+    uint8_t argCount;
+    uint8_t cpu;
+    const char *message;
+    uint64_t timestamp;     // Nanoseconds since boot
+    uint32_t args[LOG_MAX_ARGS];
+} LogRecord;
+
+/* Producers on any CPU or in IRQs claim positions by advancing `head` with a
+ * compare-exchange and publish the record through its sequence. The drain
+ * side takes drainLock only to pop, the records are rendered outside of it */
+static LogRecord ring[LOG_RING_SIZE];
+static volatile uint32_t head = 0;
+static uint32_t tail = 0;
+static Spinlock drainLock = SPINLOCK_INIT;
+static volatile uint32_t dropped = 0;
+static uint32_t droppedReported = 0;
+static uint32_t sinks =
+#ifdef LOG_VGA
+    LOG_SINK_CONSOLE;
+#else
+    LOG_SINK_SERIAL;
+#endif
+
+static const char levelNames[] = { 'E', 'W', 'I', 'D' };
+static const char *categoryNames[] = { "kernel", "cpu", "memory", "disk", "fs", "drivers" };
+
+void logRecord(uint32_t level, uint32_t category, const char *message, uint32_t argCount,
+               uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+    uint32_t position = head;
+    LogRecord *record;
+    while (true) {
+        record = &ring[position & LOG_RING_MASK];
+        uint32_t lap = position & ~LOG_RING_MASK;
+        int turn = (int)(record->sequence - lap);
+        if (turn == 0) {
+            if (atomicCompareExchange(&head, position, position + 1))
+                break;
+        } else if (turn < 0) {
+            // Still holds a record from the last lap, the ring is full
+            atomicFetchAdd(&dropped, 1);
+            return;
+        }
+        // Another producer got there first
+        position = head;
+    }
+
+    record->level = (uint8_t)level;
+    record->category = (uint8_t)category;
+    record->argCount = (uint8_t)argCount;
+    record->cpu = (uint8_t)cpuCurrent()->index;
+    record->message = message;
+    record->timestamp = getNanosecondsSinceBoot();
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    // x86 doesn't reorder stores, the compiler mustn't either
+    compilerBarrier();
+    record->sequence = (position & ~LOG_RING_MASK) + 1;
+}
+
+static bool pop(LogRecord *out) {
+    uint32_t flags = spinLockIrqSave(&drainLock);
+    LogRecord *record = &ring[tail & LOG_RING_MASK];
+    uint32_t lap = tail & ~LOG_RING_MASK;
+    bool found = record->sequence == lap + 1;
+    if (found) {
+        *out = *record;
+        compilerBarrier();
+        record->sequence = lap + LOG_RING_SIZE;
+        tail++;
+    }
+    spinUnlockIrqRestore(&drainLock, flags);
+    return found;
+}
+
+static void emit(char *line, uint32_t length) {
+    if (sinks & LOG_SINK_SERIAL)
+        serialWriteStatic(line, length);
+    if (sinks & LOG_SINK_CONSOLE)
+        vgaWriteStatic(line, length);
+}
+
+// "[seconds.micros] L cpu category: message", formatted into one buffer
+static void render(LogRecord *record) {
+    char line[LOG_LINE_LENGTH];
+    uint32_t nanoseconds;
+    uint32_t seconds = (uint32_t)udiv64(record->timestamp, 1000000000, &nanoseconds);
+    uint32_t category = 0;
+    while (category < sizeof(categoryNames) / sizeof(categoryNames[0]) - 1 && (record->category & (1 << category)) == 0)
+        category++;
+
+    uint32_t length = snprintf(line, sizeof(line), "[%4u.%06u] %c %u %s: ", seconds, nanoseconds / 1000,
+                               record->level < sizeof(levelNames) ? levelNames[record->level] : '?',
+                               record->cpu, categoryNames[category]);
+    // Leave room for the newline
+    if (length < sizeof(line) - 1)
+        length += snprintfArgs(line + length, sizeof(line) - 1 - length, record->message, record->args, record->argCount);
+    if (length > sizeof(line) - 2)
+        length = sizeof(line) - 2;
+    line[length++] = '\n';
+    emit(line, length);
+}
+
+static void drain() {
+    LogRecord record;
+    while (pop(&record))
+        render(&record);
+
+    uint32_t lost = dropped;
+    if (lost != droppedReported) {
+        char line[LOG_LINE_LENGTH];
+        uint32_t length = snprintf(line, sizeof(line), "log: %u records dropped\n", lost - droppedReported);
+        droppedReported = lost;
+        emit(line, length);
+    }
+}
+
+static void logLoop(void *arg) {
+    while (true) {
+        drain();
+        threadSleep(LOG_DRAIN_PERIOD_MS);
+    }
+}
+
+void logInit() {
+    threadCreate("log", logLoop, NULL, THREAD_PRIORITY_NORMAL);
+}
+
+void logSetSinks(uint32_t mask) {
+    sinks = mask;
+}
+
+void logFlush() {
+    drain();
+}
+
+uint32_t logDropped() {
+    return dropped;
+}
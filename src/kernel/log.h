@@ -0,0 +1,84 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "../types.h"
+
+/* Kernel log. A log statement only stores a binary record in a lock-free ring:
+ * a timestamp, its level and category, a pointer to the message and up to
+ * LOG_MAX_ARGS arguments. The "log" thread renders the records to the sinks
+ * later, so logging is cheap enough for IRQ handlers, any CPU and hot paths.
+ *
+ * Statements below LOG_LEVEL or outside LOG_CATEGORIES compile to nothing,
+ * their arguments aren't even evaluated. Both are set in debug.h and can be
+ * overridden from the build, e.g. CFLAGS="-DLOG_LEVEL=LOG_LEVEL_DEBUG".
+ *
+ *     LOG_INFO(LOG_CAT_DISK, "Drive %u identified, status %x", target, status);
+ *
+ * The message and %s arguments are only read when the record is drained, so
+ * they must be static strings. Messages are snprintf formats (libc/printf.h)
+ * without the final newline. Records are dropped while the ring is full. */
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#define LOG_CAT_KERNEL  0x01
+#define LOG_CAT_CPU     0x02
+#define LOG_CAT_MEMORY  0x04
+#define LOG_CAT_DISK    0x08
+#define LOG_CAT_FS      0x10
+#define LOG_CAT_DRIVERS 0x20
+#define LOG_CAT_ALL     0x3F
+
+#define LOG_SINK_SERIAL  0x01
+#define LOG_SINK_CONSOLE 0x02
+
+#define LOG_RING_SIZE       512     // Records, a power of two
+#define LOG_MAX_ARGS        3
+#define LOG_DRAIN_PERIOD_MS 20      // How often the log thread looks for records
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES LOG_CAT_ALL
+#endif
+
+/* Start the thread draining the ring to the sinks. Records can be written
+ * before, they wait in the ring. Call after threadInit */
+void logInit();
+
+/* Where drained records go, a mask of LOG_SINK_* */
+void logSetSinks(uint32_t sinks);
+
+/* Drain everything in the ring now, e.g. before a report or in a panic.
+ * Works with interrupts disabled */
+void logFlush();
+
+/* Records dropped because the ring was full */
+uint32_t logDropped();
+
+/* Use the macros below, they do the filtering */
+void logRecord(uint32_t level, uint32_t category, const char *message, uint32_t argCount,
+               uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+#define LOG_ENABLED(level, category) ((level) <= LOG_LEVEL && ((category) & LOG_CATEGORIES) != 0)
+
+// Counts the arguments after the message, up to LOG_MAX_ARGS
+#define LOG_COUNT_(message, a, b, c, n, ...) n
+#define LOG_COUNT(...) LOG_COUNT_(__VA_ARGS__, 3, 2, 1, 0, 0)
+#define LOG_CALL_(level, category, n, message, a, b, c, ...) \
+    logRecord((level), (category), (message), (n), (uint32_t)(a), (uint32_t)(b), (uint32_t)(c))
+
+#define LOG_AT(level, category, ...) do { \
+        if (LOG_ENABLED(level, category)) \
+            LOG_CALL_(level, category, LOG_COUNT(__VA_ARGS__), __VA_ARGS__, 0, 0, 0, 0); \
+    } while (0)
+
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+#define LOG_WARN(category, ...)  LOG_AT(LOG_LEVEL_WARN, category, __VA_ARGS__)
+#define LOG_INFO(category, ...)  LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+
+#endif // LOG_H
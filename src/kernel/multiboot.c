@@ -0,0 +1,179 @@
+#include "multiboot.h"
+#include "log.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+#define MULTIBOOT_INFO_MEMORY  0x001    // mem_lower and mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE 0x004
+#define MULTIBOOT_INFO_MODULES 0x008
+#define MULTIBOOT_INFO_MMAP    0x040
+
+#define UPPER_MEMORY_START     0x100000
+#define KERNEL_OFFSET          0x1000   // Same as -Ttext in build.sh
+
+// What the loader hands over, as laid out by the specification
+typedef struct {
+    uint32_t flags;
+    uint32_t memLower;      // KiB below 1 MiB
+    uint32_t memUpper;      // KiB from 1 MiB up to the first hole
+    uint32_t bootDevice;
+    uint32_t cmdline;
+    uint32_t modsCount;
+    uint32_t modsAddress;
+    uint32_t syms[4];
+    uint32_t mmapLength;
+    uint32_t mmapAddress;
+} __attribute__((packed)) MultibootInfo;
+
+typedef struct {
+    uint32_t size;          // Of the rest of the entry, the next one starts size + 4 bytes further
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed)) MultibootMmapEntry;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;           // One past the last byte
+    uint32_t string;
+    uint32_t reserved;
+} __attribute__((packed)) MultibootModuleEntry;
+
+extern char _end[];         // From the linker, the image and its BSS end here
+
+uint32_t multibootMagic;
+uint32_t multibootInfoAddress;
+
+static bool booted = false;
+static char commandLine[MULTIBOOT_CMDLINE_LENGTH];
+static MultibootRegion regions[MULTIBOOT_MAX_REGIONS];
+static uint32_t regionCount = 0;
+static uint32_t upperMemory = 0;
+static MultibootModule modules[MULTIBOOT_MAX_MODULES];
+static uint32_t moduleCount = 0;
+
+/* Whether [address, address + length) overlaps the kernel. The loader writes its
+ * tables before it copies the image, so anything in there was overwritten */
+static bool inKernel(uint32_t address, uint32_t length) {
+    return address < (uint32_t)_end && address + length > KERNEL_OFFSET;
+}
+
+// Copy a loader string, cut to fit
+static void copyString(uint32_t address, char *dest, uint32_t size) {
+    char *source = (char *)address;
+    uint32_t i = 0;
+    while (i < size - 1 && source[i] != '\0') {
+        dest[i] = source[i];
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+static void readMemoryMap(MultibootInfo *info) {
+    uint32_t entry = info->mmapAddress;
+    uint32_t end = info->mmapAddress + info->mmapLength;
+    while (entry < end && regionCount < MULTIBOOT_MAX_REGIONS) {
+        MultibootMmapEntry *raw = (MultibootMmapEntry *)entry;
+        MultibootRegion *region = &regions[regionCount++];
+        region->base = raw->base;
+        region->length = raw->length;
+        region->type = raw->type;
+        LOG_INFO(LOG_CAT_MEMORY, "Memory %x, %u KiB, %s", (uint32_t)raw->base, (uint32_t)(raw->length >> 10),
+                 raw->type == MULTIBOOT_REGION_AVAILABLE ? "available" : "reserved");
+
+        // The heap grows from 1 MiB through the region holding it, as far as 32 bits go
+        uint64_t regionEnd = raw->base + raw->length;
+        if (raw->type == MULTIBOOT_REGION_AVAILABLE && raw->base <= UPPER_MEMORY_START && regionEnd > UPPER_MEMORY_START)
+            upperMemory = regionEnd > 0x100000000ULL ? 0 - UPPER_MEMORY_START : (uint32_t)(regionEnd - UPPER_MEMORY_START);
+        entry += raw->size + 4;
+    }
+}
+
+static void readModules(MultibootInfo *info) {
+    MultibootModuleEntry *entries = (MultibootModuleEntry *)info->modsAddress;
+    for (uint32_t i = 0; i < info->modsCount; i++) {
+        MultibootModuleEntry *entry = &entries[i];
+        if (moduleCount == MULTIBOOT_MAX_MODULES || entry->end > MULTIBOOT_MODULE_LIMIT || entry->end < entry->start
+            || inKernel(entry->start, entry->end - entry->start)) {
+            LOG_WARN(LOG_CAT_KERNEL, "Module at %x-%x skipped", entry->start, entry->end);
+            continue;
+        }
+        MultibootModule *module = &modules[moduleCount++];
+        module->size = entry->end - entry->start;
+        module->data = (byte *)malloc(module->size);
+        memcpy((char *)entry->start, (char *)module->data, module->size);
+        if (entry->string)
+            copyString(entry->string, module->name, sizeof(module->name));
+        else
+            module->name[0] = '\0';
+        LOG_INFO(LOG_CAT_KERNEL, "Module %s, %u bytes", module->name, module->size);
+    }
+}
+
+void multibootInit() {
+    if (multibootMagic != MULTIBOOT_BOOTLOADER_MAGIC)
+        return;
+    booted = true;
+    MultibootInfo *info = (MultibootInfo *)multibootInfoAddress;
+    if (inKernel(multibootInfoAddress, sizeof(MultibootInfo))) {
+        LOG_WARN(LOG_CAT_KERNEL, "Multiboot info at %x is inside the kernel, ignored", multibootInfoAddress);
+        return;
+    }
+
+    if ((info->flags & MULTIBOOT_INFO_CMDLINE) && !inKernel(info->cmdline, 1)) {
+        copyString(info->cmdline, commandLine, sizeof(commandLine));
+        LOG_INFO(LOG_CAT_KERNEL, "Command line: %s", commandLine);
+    }
+    if ((info->flags & MULTIBOOT_INFO_MMAP) && !inKernel(info->mmapAddress, info->mmapLength))
+        readMemoryMap(info);
+    else if (info->flags & MULTIBOOT_INFO_MEMORY)
+        upperMemory = info->memUpper * 1024;
+    LOG_INFO(LOG_CAT_MEMORY, "%u KiB of memory for the heap", upperMemory >> 10);
+    if ((info->flags & MULTIBOOT_INFO_MODULES) && info->modsCount <= MULTIBOOT_MAX_MODULES
+        && !inKernel(info->modsAddress, info->modsCount * sizeof(MultibootModuleEntry)))
+        readModules(info);
+}
+
+bool multibootBooted() {
+    return booted;
+}
+
+char *multibootCommandLine() {
+    return commandLine;
+}
+
+bool multibootHasOption(char *option) {
+    uint32_t length = strlen(option);
+    char *word = commandLine;
+    while (*word != '\0') {
+        while (*word == ' ')
+            word++;
+        uint32_t wordLength = 0;
+        while (word[wordLength] != '\0' && word[wordLength] != ' ')
+            wordLength++;
+        if (wordLength == length && wordLength > 0 && memequal(word, option, length))
+            return true;
+        word += wordLength;
+    }
+    return false;
+}
+
+uint32_t multibootRegionCount() {
+    return regionCount;
+}
+
+MultibootRegion *multibootRegion(uint32_t index) {
+    return index < regionCount ? &regions[index] : NULL;
+}
+
+uint32_t multibootUpperMemory() {
+    return upperMemory;
+}
+
+uint32_t multibootModuleCount() {
+    return moduleCount;
+}
+
+MultibootModule *multibootModule(uint32_t index) {
+    return index < moduleCount ? &modules[index] : NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "../types.h"
+
+/* Multiboot (version 1) boot, e.g. `qemu-system-i386 -kernel bin/kernel.bin
+ * -append "..." -initrd "module,..."`, which skips the boot sector and the
+ * disk load. kernel_entry.asm holds the header and leaves the loader's magic
+ * and info address here; multibootInit copies what the kernel uses out of low
+ * memory before the trampoline and the stack can overwrite it.
+ *
+ * The kernel is loaded at 0x1000, so modules have to end below
+ * MULTIBOOT_MODULE_LIMIT. A loader that needs the kernel above 1 MiB (GRUB)
+ * won't take this one. QEMU writes the info and the memory map at 0x9000
+ * before it copies the image over them, and multibootInit ignores whatever
+ * overlaps the kernel: the boot still works, without a command line, memory
+ * map or modules. */
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_MAX_REGIONS      32
+#define MULTIBOOT_MAX_MODULES      8
+#define MULTIBOOT_CMDLINE_LENGTH   256
+#define MULTIBOOT_NAME_LENGTH      64
+#define MULTIBOOT_MODULE_LIMIT     0x80000  // The boot stack grows down from 0x90000
+
+#define MULTIBOOT_REGION_AVAILABLE 1
+
+/* One entry of the BIOS memory map */
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;          // MULTIBOOT_REGION_AVAILABLE, anything else is reserved
+} MultibootRegion;
+
+typedef struct {
+    byte *data;             // Copied onto the heap
+    uint32_t size;
+    char name[MULTIBOOT_NAME_LENGTH];   // The module's string, usually its file name
+} MultibootModule;
+
+/* Set by kernel_entry.asm, the magic is 0 when the boot sector loaded us */
+extern uint32_t multibootMagic;
+extern uint32_t multibootInfoAddress;
+
+/* Take over the loader's info. Call right after smpInitBoot, before smpInit */
+void multibootInit();
+
+bool multibootBooted();
+
+/* The command line, "" without one */
+char *multibootCommandLine();
+
+/* Whether `option` is one of the space separated words of the command line */
+bool multibootHasOption(char *option);
+
+uint32_t multibootRegionCount();
+MultibootRegion *multibootRegion(uint32_t index);
+
+/* Bytes of available memory from 1 MiB on, where the heap lives. 0 without a memory map */
+uint32_t multibootUpperMemory();
+
+uint32_t multibootModuleCount();
+MultibootModule *multibootModule(uint32_t index);
+
+#endif // MULTIBOOT_H
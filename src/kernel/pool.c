@@ -0,0 +1,235 @@
+#include "pool.h"
+
+#include "../cpu/smp.h"
+#include "../cpu/atomic.h"
+#include "../cpu/utils.h"
+#include "../libc/mem.h"
+
+#define DEQUE_MASK (POOL_DEQUE_SIZE - 1)
+
+// Chase-Lev deque over a fixed ring. Indices only grow, their difference is the size
+typedef struct {
+    volatile uint32_t top;      // Next job to steal
+    volatile uint32_t bottom;   // Next free slot of the owner
+    PoolJob *volatile jobs[POOL_DEQUE_SIZE];
+} Deque;
+
+typedef struct RangeLoop RangeLoop;
+
+typedef struct {
+    PoolJob job;
+    RangeLoop *loop;
+    uint32_t begin;
+    uint32_t end;
+} RangeJob;
+
+struct RangeLoop {
+    PoolRangeFunction function;
+    void *arg;
+    uint32_t grain;
+    PoolGroup group;
+    RangeJob *jobs;             // Room for every piece the range can split into
+    volatile uint32_t nextJob;
+};
+
+static Deque deques[SMP_MAX_CPUS];
+static volatile uint32_t sleeping[SMP_MAX_CPUS];    // Set while a CPU needs an smpCall to look for work again
+static uint32_t workerCount = 1;
+
+static bool dequePush(Deque *deque, PoolJob *job) {
+    uint32_t bottom = deque->bottom;
+    if (bottom - deque->top >= POOL_DEQUE_SIZE)
+        return false;
+    deque->jobs[bottom & DEQUE_MASK] = job;
+    compilerBarrier(); // Stores stay in order on x86, thieves see the job before the new bottom
+    deque->bottom = bottom + 1;
+    return true;
+}
+
+static PoolJob *dequePop(Deque *deque) {
+    uint32_t bottom = deque->bottom - 1;
+    deque->bottom = bottom;
+    atomicFence(); // Publish the claim before reading top, or a thief could take the same job
+    uint32_t top = deque->top;
+
+    int size = (int)(bottom - top);
+    if (size < 0) {
+        deque->bottom = top;
+        return NULL;
+    }
+    PoolJob *job = deque->jobs[bottom & DEQUE_MASK];
+    if (size > 0)
+        return job;
+
+    // The last job, which a thief may be after too
+    if (!atomicCompareExchange(&deque->top, top, top + 1))
+        job = NULL;
+    deque->bottom = top + 1;
+    return job;
+}
+
+static PoolJob *dequeSteal(Deque *deque) {
+    uint32_t top = deque->top;
+    compilerBarrier(); // Loads stay in order on x86
+    uint32_t bottom = deque->bottom;
+    if ((int)(bottom - top) <= 0)
+        return NULL;
+    PoolJob *job = deque->jobs[top & DEQUE_MASK];
+    if (!atomicCompareExchange(&deque->top, top, top + 1))
+        return NULL;
+    return job;
+}
+
+// The owner's end of a deque is also used by every thread on the boot CPU,
+// so those operations mustn't be interrupted by a thread switch
+
+static bool pushLocal(PoolJob *job) {
+    uint32_t flags = irqSave();
+    bool pushed = dequePush(&deques[cpuCurrent()->index], job);
+    irqRestore(flags);
+    return pushed;
+}
+
+static PoolJob *popLocal() {
+    uint32_t flags = irqSave();
+    PoolJob *job = dequePop(&deques[cpuCurrent()->index]);
+    irqRestore(flags);
+    return job;
+}
+
+static PoolJob *findJob() {
+    PoolJob *job = popLocal();
+    uint32_t self = cpuCurrent()->index;
+    for (uint32_t i = 1; job == NULL && i < workerCount; i++)
+        job = dequeSteal(&deques[(self + i) % workerCount]);
+    return job;
+}
+
+static bool anyJobs() {
+    for (uint32_t i = 0; i < workerCount; i++) {
+        if ((int)(deques[i].bottom - deques[i].top) > 0)
+            return true;
+    }
+    return false;
+}
+
+static void runJob(PoolJob *job) {
+    PoolGroup *group = job->group;
+    job->function(job->arg);
+    // The job may be gone as soon as the group is done
+    atomicFetchAdd(&group->pending, (uint32_t)-1);
+}
+
+// Runs on the other CPUs through smpCall, for as long as there is work
+static void workerRun(void *arg) {
+    uint32_t self = cpuCurrent()->index;
+    while (true) {
+        PoolJob *job = findJob();
+        if (job) {
+            runJob(job);
+            continue;
+        }
+        sleeping[self] = 1;
+        atomicFence();
+        // A job pushed before we were marked didn't wake us, so look once more.
+        // If somebody cleared the mark, their smpCall brings us back here
+        if (!anyJobs() || !atomicCompareExchange(&sleeping[self], 1, 0))
+            return;
+    }
+}
+
+static void wakeWorker() {
+    atomicFence(); // The pushed job must be visible before reading the marks
+    for (uint32_t i = 1; i < workerCount; i++) {
+        if (sleeping[i] && atomicCompareExchange(&sleeping[i], 1, 0)) {
+            smpCall(i, workerRun, NULL);
+            return;
+        }
+    }
+}
+
+void poolInit() {
+    workerCount = smpCpuCount();
+    for (uint32_t i = 1; i < workerCount; i++)
+        sleeping[i] = 1;
+}
+
+uint32_t poolWorkerCount() {
+    return workerCount;
+}
+
+void poolGroupInit(PoolGroup *group) {
+    group->pending = 0;
+}
+
+void poolSpawn(PoolGroup *group, PoolJob *job, PoolFunction function, void *arg) {
+    job->function = function;
+    job->arg = arg;
+    job->group = group;
+    atomicFetchAdd(&group->pending, 1);
+    if (!pushLocal(job)) {
+        runJob(job);
+        return;
+    }
+    if (workerCount > 1)
+        wakeWorker();
+}
+
+void poolWait(PoolGroup *group) {
+    while (group->pending) {
+        PoolJob *job = findJob();
+        if (job)
+            runJob(job);
+        else
+            __asm__ __volatile__("rep; nop"); // pause
+    }
+}
+
+static void runRange(void *arg) {
+    RangeJob *range = (RangeJob *)arg;
+    RangeLoop *loop = range->loop;
+    uint32_t begin = range->begin;
+    uint32_t end = range->end;
+
+    // Offer the upper halves to other CPUs and keep splitting the lower one
+    while (end - begin > loop->grain) {
+        uint32_t middle = begin + (end - begin) / 2;
+        RangeJob *half = &loop->jobs[atomicFetchAdd(&loop->nextJob, 1)];
+        half->loop = loop;
+        half->begin = middle;
+        half->end = end;
+        poolSpawn(&loop->group, &half->job, runRange, half);
+        end = middle;
+    }
+    loop->function(loop->arg, begin, end);
+}
+
+void poolParallelFor(uint32_t begin, uint32_t end, uint32_t grain, PoolRangeFunction function, void *arg) {
+    if (end <= begin)
+        return;
+    if (grain == 0)
+        grain = 1;
+    uint32_t count = end - begin;
+    if (workerCount == 1 || count <= grain) {
+        function(arg, begin, end);
+        return;
+    }
+
+    // Pieces end up longer than grain / 2, so there are at most this many of them
+    uint32_t pieces = count / ((grain + 1) / 2);
+    RangeLoop loop;
+    loop.function = function;
+    loop.arg = arg;
+    loop.grain = grain;
+    poolGroupInit(&loop.group);
+    loop.jobs = (RangeJob *)malloc(pieces * sizeof(RangeJob));
+    loop.nextJob = 1;
+
+    RangeJob *root = &loop.jobs[0];
+    root->loop = &loop;
+    root->begin = begin;
+    root->end = end;
+    runRange(root);
+    poolWait(&loop.group);
+    free(loop.jobs);
+}
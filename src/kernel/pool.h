@@ -0,0 +1,53 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "../types.h"
+
+/* Work-stealing job pool for bulk work that splits into independent pieces.
+ * Every CPU has a deque of jobs: it pushes and pops at the bottom, idle CPUs
+ * steal from the top of the others' (Chase-Lev). The other CPUs are woken with
+ * smpCall when work shows up and go back to sleep once there is none left.
+ *
+ * The boot CPU only runs jobs while it waits for a group, so a single CPU
+ * simply runs everything inline. Jobs may spawn more jobs and wait for them,
+ * but must not use the thread API, tasks or timers, they may run on any CPU.
+ * Not for use from interrupt handlers. */
+
+#define POOL_DEQUE_SIZE 256     // Jobs per CPU, a power of two. Spawning into a full deque runs the job at once
+
+typedef void (*PoolFunction)(void *arg);
+
+/* Body of a parallel loop, called for the indices in [begin, end) */
+typedef void (*PoolRangeFunction)(void *arg, uint32_t begin, uint32_t end);
+
+/* Jobs that can be waited for together */
+typedef struct {
+    volatile uint32_t pending;  // Spawned and not finished yet
+} PoolGroup;
+
+typedef struct {
+    PoolFunction function;
+    void *arg;
+    PoolGroup *group;
+} PoolJob;
+
+/* Call after smpInit */
+void poolInit();
+
+/* CPUs that run jobs, including the boot CPU */
+uint32_t poolWorkerCount();
+
+void poolGroupInit(PoolGroup *group);
+
+/* Queue `function(arg)` as part of `group`. The job must stay valid until the
+ * group has been waited for */
+void poolSpawn(PoolGroup *group, PoolJob *job, PoolFunction function, void *arg);
+
+/* Run and steal jobs until every job of the group has finished */
+void poolWait(PoolGroup *group);
+
+/* Call `function` over [begin, end) split into pieces of at least `grain`
+ * indices, and return once all of them are done */
+void poolParallelFor(uint32_t begin, uint32_t end, uint32_t grain, PoolRangeFunction function, void *arg);
+
+#endif // POOL_H
@@ -0,0 +1,177 @@
+#include "profiler.h"
+
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../libc/mem.h"
+#include "../libc/ring.h"
+#include "../libc/printf.h"
+#include "../drivers/serial.h"
+
+#define PROFILER_TOP_FUNCTIONS 20
+#define PROFILER_MAX_FRAME     0x10000  // Larger steps up the EBP chain are taken for garbage
+
+typedef struct {
+    uint32_t depth;
+    uint32_t pcs[PROFILER_MAX_DEPTH];   // Innermost first. The report replaces them with symbol indices
+} Sample;
+
+static SpscRing samples;
+static Sample *sampleStorage = NULL;
+static uint32_t dropped = 0;
+static Timer sampleTimer;
+static uint32_t period = 0;
+static volatile bool running = false;
+
+// Index of the symbol containing `address`, profilerSymbolCount if there is none.
+// build.sh ends the table with a terminator at the end of the text
+static uint32_t findSymbol(uint32_t address) {
+    uint32_t count = profilerSymbolCount;
+    if (count == 0 || address < profilerSymbols[0].address)
+        return count;
+    uint32_t end = profilerSymbols[count].address;
+    if (end != 0 && address >= end)
+        return count;
+
+    uint32_t low = 0, high = count - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (profilerSymbols[middle].address <= address)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+const char *profilerSymbolName(uint32_t address) {
+    uint32_t index = findSymbol(address);
+    return index < profilerSymbolCount ? profilerSymbols[index].name : NULL;
+}
+
+// Runs in the timer interrupt
+static void takeSample(void *arg) {
+    registers_t *frame = interruptFrame();
+    if (frame) {
+        Sample sample;
+        sample.depth = 0;
+        sample.pcs[sample.depth++] = frame->eip;
+
+        // Compiled without -fomit-frame-pointer, every frame starts with the
+        // caller's EBP and the return address
+        uint32_t ebp = frame->ebp;
+        while (sample.depth < PROFILER_MAX_DEPTH && ebp != 0 && (ebp & 3) == 0) {
+            uint32_t *link = (uint32_t *)ebp;
+            if (findSymbol(link[1]) == profilerSymbolCount)
+                break;
+            sample.pcs[sample.depth++] = link[1];
+            if (link[0] <= ebp || link[0] - ebp > PROFILER_MAX_FRAME)
+                break;
+            ebp = link[0];
+        }
+        if (!spscPush(&samples, &sample))
+            dropped++;
+    }
+    if (running)
+        timerStart(&sampleTimer, period);
+}
+
+void profilerStart(uint32_t periodMs) {
+    if (sampleStorage == NULL) {
+        sampleStorage = (Sample *)malloc(PROFILER_MAX_SAMPLES * sizeof(Sample));
+        spscInit(&samples, sampleStorage, PROFILER_MAX_SAMPLES, sizeof(Sample));
+        timerInit(&sampleTimer, takeSample, NULL);
+    }
+    period = periodMs;
+    running = true;
+    timerStart(&sampleTimer, period);
+}
+
+void profilerStop() {
+    running = false;
+    timerCancel(&sampleTimer);
+}
+
+// Outermost frame first, then the deeper ones, so equal stacks end up next to each other
+static int compareStacks(Sample *a, Sample *b) {
+    uint32_t i = a->depth, j = b->depth;
+    while (i > 0 && j > 0) {
+        i--;
+        j--;
+        if (a->pcs[i] != b->pcs[j])
+            return a->pcs[i] < b->pcs[j] ? -1 : 1;
+    }
+    return (int)i - (int)j;
+}
+
+static void sortStacks(Sample *list, uint32_t count) {
+    for (uint32_t gap = count / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < count; i++) {
+            Sample sample = list[i];
+            uint32_t j = i;
+            for (; j >= gap && compareStacks(&list[j - gap], &sample) > 0; j -= gap)
+                list[j] = list[j - gap];
+            list[j] = sample;
+        }
+    }
+}
+
+static const char *symbolName(uint32_t index) {
+    return index < profilerSymbolCount ? profilerSymbols[index].name : "?";
+}
+
+static void reportFunctions(Sample *list, uint32_t count) {
+    uint32_t *hits = (uint32_t *)calloc(profilerSymbolCount + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++)
+        hits[list[i].pcs[0]]++;
+
+    serialWrite("Samples per function:\n");
+    for (uint32_t n = 0; n < PROFILER_TOP_FUNCTIONS; n++) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i <= profilerSymbolCount; i++) {
+            if (hits[i] > hits[best])
+                best = i;
+        }
+        if (hits[best] == 0)
+            break;
+        serialPrintf("  %u %u%% %s\n", hits[best], hits[best] * 100 / count, symbolName(best));
+        hits[best] = 0;
+    }
+    free(hits);
+}
+
+static void reportStacks(Sample *list, uint32_t count) {
+    sortStacks(list, count);
+    serialWrite("Folded stacks:\n");
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        run++;
+        if (i + 1 < count && compareStacks(&list[i], &list[i + 1]) == 0)
+            continue;
+        for (uint32_t d = list[i].depth; d > 0; d--) {
+            serialPrintf("%s%c", symbolName(list[i].pcs[d - 1]), d > 1 ? ';' : ' ');
+        }
+        serialPrintf("%u\n", run);
+        run = 0;
+    }
+}
+
+void profilerReport() {
+    if (sampleStorage == NULL)
+        return;
+    uint32_t available = spscCount(&samples);
+    Sample *list = (Sample *)malloc((available ? available : 1) * sizeof(Sample));
+    uint32_t count = 0;
+    while (count < available && spscPop(&samples, &list[count])) {
+        for (uint32_t d = 0; d < list[count].depth; d++)
+            list[count].pcs[d] = findSymbol(list[count].pcs[d]);
+        count++;
+    }
+
+    serialPrintf("Profile: %u samples, %u dropped\n", count, dropped);
+    if (count) {
+        reportFunctions(list, count);
+        reportStacks(list, count);
+    }
+    dropped = 0;
+    free(list);
+}
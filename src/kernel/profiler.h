@@ -0,0 +1,36 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "../types.h"
+
+/* Statistical profiler. A timer samples the interrupted EIP and the return
+ * addresses found by following the EBP chain into a ring, and the report
+ * resolves them against the symbol table build.sh links into the kernel.
+ * Enabled at boot by building with CFLAGS=-DPROFILE.
+ *
+ * The report has a flat profile per function and folded stacks, one
+ * "outer;...;inner count" line each, which flamegraph.pl takes as is. */
+
+#define PROFILER_MAX_SAMPLES 2048   // Ring size, samples are dropped while it is full
+#define PROFILER_MAX_DEPTH   8      // Frames kept per sample, the sampled function included
+
+/* Generated by build.sh from the linked kernel, sorted by address */
+typedef struct {
+    uint32_t address;
+    const char *name;
+} ProfilerSymbol;
+
+extern const ProfilerSymbol profilerSymbols[];
+extern const uint32_t profilerSymbolCount;
+
+/* Sample every `periodMs` milliseconds until profilerStop. Call after init_timer */
+void profilerStart(uint32_t periodMs);
+void profilerStop();
+
+/* Name of the function containing `address`, NULL if it isn't in the kernel's text */
+const char *profilerSymbolName(uint32_t address);
+
+/* Print the samples taken so far over serial and discard them */
+void profilerReport();
+
+#endif // PROFILER_H
@@ -0,0 +1,85 @@
+#include "readahead.h"
+#include "log.h"
+#include "../libc/mem.h"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;         // DiskExtents following
+} ProfileHeader;
+
+static DiskInfo *disk = NULL;
+static DiskExtent *profile = NULL;     // As loaded, sorted by the replay
+static uint32_t profileCount = 0;
+
+static void loadProfile(FSInfo *fs) {
+    if (!fsPathExists(fs, READAHEAD_PROFILE))
+        return;
+    uint32_t size = fsFileSize(fs, READAHEAD_PROFILE);
+    if (size < sizeof(ProfileHeader))
+        return;
+    byte *data = (byte *)malloc(size);
+    ProfileHeader *header = (ProfileHeader *)data;
+    uint32_t count = (size - sizeof(ProfileHeader)) / sizeof(DiskExtent);
+    if (fsReadFile(fs, READAHEAD_PROFILE, data, size) && header->magic == READAHEAD_MAGIC && header->count <= count) {
+        profileCount = header->count < DISK_RECORD_MAX ? header->count : DISK_RECORD_MAX;
+        profile = (DiskExtent *)malloc(profileCount * sizeof(DiskExtent));
+        memcpy((char *)(data + sizeof(ProfileHeader)), (char *)profile, profileCount * sizeof(DiskExtent));
+    } else {
+        LOG_WARN(LOG_CAT_FS, "Ignoring a damaged boot I/O profile");
+    }
+    free(data);
+}
+
+// Same reads in any order, neither list has repeats
+static bool sameAsProfile(DiskExtent *extents, uint32_t count) {
+    if (profile == NULL || count != profileCount)
+        return false;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t j = 0;
+        while (j < profileCount && (profile[j].sector != extents[i].sector || profile[j].count != extents[i].count))
+            j++;
+        if (j == profileCount)
+            return false;
+    }
+    return true;
+}
+
+static void saveProfile(FSInfo *fs, DiskExtent *extents, uint32_t count) {
+    uint32_t size = sizeof(ProfileHeader) + count * sizeof(DiskExtent);
+    byte *data = (byte *)malloc(size);
+    ProfileHeader *header = (ProfileHeader *)data;
+    header->magic = READAHEAD_MAGIC;
+    header->count = count;
+    memcpy((char *)extents, (char *)(data + sizeof(ProfileHeader)), count * sizeof(DiskExtent));
+    if (!fsPathExists(fs, READAHEAD_PROFILE))
+        fsCreateFile(fs, READAHEAD_PROFILE);
+    if (fsWriteFile(fs, READAHEAD_PROFILE, data, size))
+        LOG_INFO(LOG_CAT_FS, "Boot I/O profile saved, %u reads", count);
+    free(data);
+}
+
+void readaheadStart(DiskInfo *bootDisk, FSInfo *fs) {
+    disk = bootDisk;
+    diskCacheStart(disk);
+    // What loading the profile reads stays cached, and is skipped by the replay
+    loadProfile(fs);
+    if (profile)
+        diskReadahead(disk, profile, profileCount);
+    diskRecordStart(disk);
+}
+
+void readaheadFinish(FSInfo *fs) {
+    if (disk == NULL)
+        return;
+    DiskExtent *extents = (DiskExtent *)malloc(DISK_RECORD_MAX * sizeof(DiskExtent));
+    uint32_t count = diskRecordStop(extents, DISK_RECORD_MAX);
+    diskCacheStop(disk);
+    if (count > 0 && !sameAsProfile(extents, count))
+        saveProfile(fs, extents, count);
+
+    free(extents);
+    free(profile);
+    profile = NULL;
+    profileCount = 0;
+    disk = NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "../types.h"
+#include "../drivers/disk.h"
+#include "../filesystem/filesystem.h"
+
+/* Boot readahead. The reads the boot makes from the volume are recorded into
+ * READAHEAD_PROFILE; the next boot replays that profile as one sorted, merged
+ * batch into the disk cache, so the filesystem's scattered small reads are
+ * answered from memory after a few large sequential ones. The profile is
+ * rewritten whenever the boot read something else. */
+
+#define READAHEAD_PROFILE "/system/bootio.bin"
+#define READAHEAD_MAGIC   0x4F494F42    // "BOIO"
+
+/* Turn the cache on, replay the profile if there is one and start recording.
+ * Call right after fsInit */
+void readaheadStart(DiskInfo *disk, FSInfo *fs);
+
+/* Stop recording, save the profile if it changed and free the cache. Call once
+ * the boot is done with the volume */
+void readaheadFinish(FSInfo *fs);
+
+#endif // READAHEAD_H
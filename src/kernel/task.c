@@ -0,0 +1,145 @@
+#include "task.h"
+
+#include "../cpu/utils.h"
+#include "../cpu/timer.h"
+#include "../libc/mem.h"
+
+// The ready queue and the events are touched from IRQs and timer callbacks
+static Task *readyHead = NULL;
+static Task *readyTail = NULL;
+
+// Must be called with interrupts disabled
+static void enqueueReady(Task *task) {
+    task->next = NULL;
+    if (readyTail)
+        readyTail->next = task;
+    else
+        readyHead = task;
+    readyTail = task;
+}
+
+// Must be called with interrupts disabled
+static Task *dequeueReady() {
+    Task *task = readyHead;
+    if (task) {
+        readyHead = task->next;
+        if (readyHead == NULL)
+            readyTail = NULL;
+        task->next = NULL;
+    }
+    return task;
+}
+
+// Runs from the timer interrupt, for TASK_SLEEP and TASK_AWAIT_TIMEOUT alike
+static void timerExpired(void *arg) {
+    Task *task = (Task *)arg;
+    TaskEvent *event = task->waitingOn;
+    if (event) {
+        Task **link = &event->waiters;
+        while (*link && *link != task)
+            link = &(*link)->next;
+        if (*link)
+            *link = task->next;
+        task->waitingOn = NULL;
+        task->timedOut = true;
+    }
+    enqueueReady(task);
+}
+
+Task *taskSpawn(TaskFunction function, uint32_t frameSize, void *arg) {
+    Task *task = (Task *)calloc(1, sizeof(Task));
+    if (task == NULL)
+        return NULL;
+    if (frameSize) {
+        task->frame = calloc(1, frameSize);
+        if (task->frame == NULL) {
+            free(task);
+            return NULL;
+        }
+    }
+    task->resume = function;
+    task->arg = arg;
+    timerInit(&task->timer, timerExpired, task);
+
+    uint32_t flags = irqSave();
+    enqueueReady(task);
+    irqRestore(flags);
+    return task;
+}
+
+void taskRunLoop() {
+    while (true) {
+        uint32_t flags = irqSave();
+        Task *task = dequeueReady();
+        if (task == NULL) {
+            // sti only takes effect after hlt, so a wakeup can't slip in between
+            __asm__ __volatile__("sti; hlt");
+            irqRestore(flags);
+            continue;
+        }
+        irqRestore(flags);
+
+        switch (task->resume(task)) {
+            case TASK_YIELDED:
+                flags = irqSave();
+                enqueueReady(task);
+                irqRestore(flags);
+                break;
+            case TASK_WAITING:
+                break;
+            case TASK_DONE:
+                timerCancel(&task->timer);
+                free(task->frame);
+                free(task);
+                break;
+        }
+    }
+}
+
+void taskEventInit(TaskEvent *event) {
+    event->waiters = NULL;
+    event->signalled = false;
+}
+
+void taskSignal(TaskEvent *event) {
+    uint32_t flags = irqSave();
+    if (event->waiters == NULL) {
+        event->signalled = true;
+    } else {
+        while (event->waiters) {
+            Task *task = event->waiters;
+            event->waiters = task->next;
+            task->waitingOn = NULL;
+            timerCancel(&task->timer);
+            enqueueReady(task);
+        }
+    }
+    irqRestore(flags);
+}
+
+bool taskWait(Task *task, TaskEvent *event) {
+    uint32_t flags = irqSave();
+    bool park = !event->signalled;
+    if (park) {
+        task->next = event->waiters;
+        event->waiters = task;
+        task->waitingOn = event;
+    }
+    event->signalled = false;
+    irqRestore(flags);
+    return park;
+}
+
+bool taskWaitTimeout(Task *task, TaskEvent *event, uint32_t ms) {
+    uint32_t flags = irqSave();
+    task->timedOut = false;
+    bool park = taskWait(task, event);
+    if (park)
+        timerStart(&task->timer, ms);
+    irqRestore(flags);
+    return park;
+}
+
+void taskSleep(Task *task, uint32_t ms) {
+    timerStart(&task->timer, ms);
+}
@@ -0,0 +1,101 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "../types.h"
+#include "../cpu/timer.h"
+
+/* Cooperative, stackless tasks for I/O-bound kernel work.
+ *
+ * A task is a function that is called again every time it is resumed. It keeps
+ * its locals in a heap frame instead of on a stack, and jumps back to where it
+ * left off with the TASK_* macros below, so a waiting task costs only its Task
+ * and its frame. All tasks run on the thread that calls taskRunLoop.
+ *
+ *     static byte readTask(Task *task) {
+ *         ReadFrame *f = (ReadFrame *)task->frame;
+ *         TASK_BEGIN(task);
+ *         diskSubmit(&f->request);
+ *         TASK_AWAIT(task, &f->request.done);
+ *         ...
+ *         TASK_END(task);
+ *     }
+ *
+ * Locals of the task function don't survive any of the suspending macros, keep
+ * everything that has to in the frame. The macros record the resume point with
+ * __LINE__, so use at most one per source line, and don't put them inside a
+ * switch statement of the task function. */
+
+#define TASK_YIELDED 0  // Still ready, run again on a later pass
+#define TASK_WAITING 1  // Parked on an event or a deadline
+#define TASK_DONE    2  // Finished, the frame and the task are freed
+
+struct Task;
+typedef byte (*TaskFunction)(struct Task *task);
+
+/* Something tasks can wait for. A signal wakes every waiting task; when nobody
+ * is waiting it is remembered, and the next wait returns at once */
+typedef struct {
+    struct Task *waiters;
+    bool signalled;
+} TaskEvent;
+
+typedef struct Task {
+    TaskFunction resume;
+    void *frame;            // Zeroed heap memory for the task's state
+    void *arg;
+    uint32_t line;          // Resume point, 0 before the first run
+    Timer timer;            // Ends TASK_SLEEP and TASK_AWAIT_TIMEOUT
+    TaskEvent *waitingOn;   // The event the task is parked on, if any
+    bool timedOut;          // Whether the last TASK_AWAIT_TIMEOUT gave up
+    struct Task *next;      // Link in the ready queue or an event's waiters
+} Task;
+
+#define TASK_BEGIN(task) switch ((task)->line) { case 0:
+
+#define TASK_END(task) } (task)->line = 0; return TASK_DONE
+
+/* Give the other ready tasks a turn */
+#define TASK_YIELD(task) \
+    do { (task)->line = __LINE__; return TASK_YIELDED; case __LINE__:; } while (0)
+
+/* Continue once `event` is signalled */
+#define TASK_AWAIT(task, event) \
+    do { if (taskWait((task), (event))) { (task)->line = __LINE__; return TASK_WAITING; } case __LINE__:; } while (0)
+
+/* Continue once `event` is signalled or `ms` milliseconds have passed, whichever
+ * comes first. task->timedOut tells which one it was */
+#define TASK_AWAIT_TIMEOUT(task, event, ms) \
+    do { if (taskWaitTimeout((task), (event), (ms))) { (task)->line = __LINE__; return TASK_WAITING; } case __LINE__:; } while (0)
+
+/* Continue after at least `ms` milliseconds */
+#define TASK_SLEEP(task, ms) \
+    do { taskSleep((task), (ms)); (task)->line = __LINE__; return TASK_WAITING; case __LINE__:; } while (0)
+
+/* Continue once `condition` holds, it is polled on every pass of the loop.
+ * Prefer TASK_AWAIT, a task polling here keeps the loop from halting */
+#define TASK_AWAIT_UNTIL(task, condition) \
+    do { (task)->line = __LINE__; case __LINE__: if (!(condition)) return TASK_YIELDED; } while (0)
+
+/* Create a task with a zeroed frame of `frameSize` bytes and make it ready.
+ * Can be called from any thread or from a running task */
+Task *taskSpawn(TaskFunction function, uint32_t frameSize, void *arg);
+
+/* Run ready tasks forever, halting the CPU while every task is waiting */
+void taskRunLoop();
+
+void taskEventInit(TaskEvent *event);
+
+/* Wake every task waiting for `event`. Safe to call from IRQs and other threads */
+void taskSignal(TaskEvent *event);
+
+/* Used by TASK_AWAIT: consume a pending signal and return false, or park the task
+ * on `event` and return true */
+bool taskWait(Task *task, TaskEvent *event);
+
+/* Used by TASK_AWAIT_TIMEOUT: like taskWait, and give up after `ms` milliseconds */
+bool taskWaitTimeout(Task *task, TaskEvent *event, uint32_t ms);
+
+/* Used by TASK_SLEEP: park the task until `ms` milliseconds have passed */
+void taskSleep(Task *task, uint32_t ms);
+
+#endif // TASK_H
@@ -0,0 +1,309 @@
+#include "thread.h"
+
+#include "../cpu/idt.h"
+#include "../cpu/utils.h"
+#include "../cpu/timer.h"
+#include "../cpu/smp.h"
+#include "../libc/mem.h"
+
+#define KERNEL_DS 0x10
+#define EFLAGS_IF 0x200
+
+static Thread bootThread;
+static Thread *idleThread = NULL;
+static Thread *current = NULL;
+
+// One FIFO per priority, round-robin inside each
+static Thread *readyHead[THREAD_PRIORITIES];
+static Thread *readyTail[THREAD_PRIORITIES];
+
+static Thread *zombies = NULL;      // Dead threads whose stacks can't be freed yet
+
+static bool needSwitch = false;
+static Timer sliceTimer;            // Only runs while another thread waits for the same priority
+static uint32_t nextId = 0;
+
+static void enqueueReady(Thread *thread) {
+    thread->state = THREAD_READY;
+    thread->next = NULL;
+    if (readyTail[thread->priority])
+        readyTail[thread->priority]->next = thread;
+    else
+        readyHead[thread->priority] = thread;
+    readyTail[thread->priority] = thread;
+}
+
+// Queue a thread that was waiting, and see whether it should take the CPU.
+// Must be called with interrupts disabled
+static void makeReady(Thread *thread) {
+    enqueueReady(thread);
+    if (current == NULL)
+        return;
+    if (current == idleThread || thread->priority > current->priority)
+        needSwitch = true;
+    else if (thread->priority == current->priority && !timerPending(&sliceTimer))
+        timerStart(&sliceTimer, THREAD_TIMESLICE_MS);
+}
+
+static Thread *dequeueReady() {
+    for (int p = THREAD_PRIORITIES - 1; p >= 0; p--) {
+        Thread *thread = readyHead[p];
+        if (thread) {
+            readyHead[p] = thread->next;
+            if (readyHead[p] == NULL)
+                readyTail[p] = NULL;
+            thread->next = NULL;
+            return thread;
+        }
+    }
+    return idleThread;
+}
+
+static void reapZombies() {
+    while (zombies) {
+        Thread *thread = zombies;
+        zombies = thread->next;
+        if (thread == &bootThread)
+            continue;   // Lives on the boot stack and in static memory
+        free(thread->stack);
+        free((void *)thread);
+    }
+}
+
+// Enter the scheduler from thread context, through the yield software interrupt.
+// Must be called with interrupts disabled.
+static void reschedule() {
+    needSwitch = true;
+    __asm__ __volatile__("int %0" : : "i" (ISR_YIELD) : "memory");
+}
+
+// Switch right away if a thread woken from thread context should run, IRQs
+// switch on their way out anyway. Must be called with interrupts disabled
+static void preempt() {
+    if (needSwitch && !inInterrupt())
+        reschedule();
+}
+
+static void sliceExpired(void *arg) {
+    needSwitch = true;
+}
+
+static void sleepExpired(void *arg) {
+    makeReady((Thread *)arg);
+}
+
+static void threadStart() {
+    // New threads are entered from an IRQ frame with interrupts enabled
+    current->entry(current->arg);
+    threadExit();
+}
+
+static void idleLoop(void *arg) {
+    while (true)
+        halt();
+}
+
+static Thread *newThread(char *name, byte priority) {
+    Thread *thread = (Thread *)calloc(1, sizeof(Thread));
+    thread->id = nextId++;
+    thread->name = name;
+    thread->priority = priority < THREAD_PRIORITIES ? priority : THREAD_PRIORITIES - 1;
+    timerInit(&thread->sleepTimer, sleepExpired, thread);
+    return thread;
+}
+
+// Build a frame on the new stack that irq_common_stub can resume into threadStart
+static void prepareStack(Thread *thread) {
+    thread->stack = malloc(THREAD_STACK_SIZE);
+    uint32_t top = ((uint32_t)thread->stack + THREAD_STACK_SIZE) & ~15;
+    registers_t *frame = (registers_t *)(top - sizeof(registers_t));
+    memset((char *)frame, 0, sizeof(registers_t));
+    frame->ds = KERNEL_DS;
+    frame->eip = (uint32_t)threadStart;
+    frame->cs = KERNEL_CS;
+    frame->eflags = EFLAGS_IF | 0x2;
+    thread->frame = frame;
+}
+
+void threadInit() {
+    bootThread.id = nextId++;
+    bootThread.name = "boot";
+    bootThread.state = THREAD_RUNNING;
+    bootThread.priority = THREAD_PRIORITY_NORMAL;
+    timerInit(&bootThread.sleepTimer, sleepExpired, &bootThread);
+    timerInit(&sliceTimer, sliceExpired, NULL);
+    current = &bootThread;
+
+    idleThread = newThread("idle", THREAD_PRIORITY_LOW);
+    idleThread->entry = idleLoop;
+    prepareStack(idleThread);
+    idleThread->state = THREAD_READY;
+}
+
+Thread *threadCreate(char *name, ThreadEntry entry, void *arg, byte priority) {
+    Thread *thread = newThread(name, priority);
+    thread->entry = entry;
+    thread->arg = arg;
+    prepareStack(thread);
+
+    uint32_t flags = irqSave();
+    makeReady(thread);
+    preempt();
+    irqRestore(flags);
+    return thread;
+}
+
+// Threads only run on the boot CPU, the others see none
+static bool threadsRunning() {
+    return current != NULL && cpuIsBoot();
+}
+
+Thread *threadCurrent() {
+    return threadsRunning() ? current : NULL;
+}
+
+void threadYield() {
+    if (!threadsRunning())
+        return;
+    uint32_t flags = irqSave();
+    reschedule();
+    irqRestore(flags);
+}
+
+void threadSleep(uint32_t ms) {
+    if (!threadsRunning())
+        return;
+    uint32_t flags = irqSave();
+    current->state = THREAD_SLEEPING;
+    timerStart(&current->sleepTimer, ms);
+    reschedule();
+    irqRestore(flags);
+}
+
+void threadBlock() {
+    if (!threadsRunning())
+        return;
+    uint32_t flags = irqSave();
+    current->state = THREAD_BLOCKED;
+    reschedule();
+    irqRestore(flags);
+}
+
+void threadWake(Thread *thread) {
+    uint32_t flags = irqSave();
+    if (thread->state == THREAD_BLOCKED) {
+        makeReady(thread);
+        preempt();
+    }
+    irqRestore(flags);
+}
+
+void threadExit() {
+    irqSave(); // Never restored, this thread doesn't run again
+    current->state = THREAD_DEAD;
+    reschedule();
+    while (true) {} // Never resumed
+}
+
+registers_t *threadIrqExit(registers_t *frame) {
+    if (!threadsRunning() || !needSwitch)
+        return frame;
+    needSwitch = false;
+
+    Thread *previous = current;
+    bool stillRunnable = previous->state == THREAD_RUNNING;
+    Thread *next = dequeueReady();
+
+    if (stillRunnable && (next == idleThread || next->priority < previous->priority)) {
+        // Only equal or higher priorities take the CPU from a runnable thread
+        if (next != idleThread) {
+            next->next = readyHead[next->priority];
+            readyHead[next->priority] = next;
+            if (readyTail[next->priority] == NULL)
+                readyTail[next->priority] = next;
+        }
+        return frame;
+    }
+
+    // None of the zombies is the stack we're running on, so they can go now
+    reapZombies();
+
+    previous->frame = frame;
+    if (previous->state == THREAD_DEAD) {
+        previous->next = zombies;
+        zombies = previous;
+    } else if (previous == idleThread) {
+        previous->state = THREAD_READY;
+    } else if (stillRunnable) {
+        enqueueReady(previous);
+    }
+
+    current = next;
+    current->state = THREAD_RUNNING;
+
+    // A fresh slice, if anyone is left to share the CPU with
+    if (current != idleThread && readyHead[current->priority])
+        timerStart(&sliceTimer, THREAD_TIMESLICE_MS);
+    else
+        timerCancel(&sliceTimer);
+    return current->frame;
+}
+
+void mutexInit(Mutex *mutex) {
+    spinInit(&mutex->guard);
+    mutex->locked = false;
+    mutex->owner = NULL;
+    mutex->waiters = NULL;
+}
+
+void mutexLock(Mutex *mutex) {
+    uint32_t flags = irqSave();
+    spinLock(&mutex->guard);
+    while (mutex->locked) {
+        if (threadsRunning() && mutex->owner != NULL) {
+            // Held by a thread, which wakes us when it unlocks. Interrupts stay
+            // off, so nothing can wake us before we're off the CPU
+            Thread **link = &mutex->waiters;
+            while (*link)
+                link = &(*link)->next;
+            current->next = NULL;
+            *link = current;
+            // Not THREAD_BLOCKED, threadWake would queue it while it's still a waiter
+            current->state = THREAD_MUTEX_WAIT;
+            spinUnlock(&mutex->guard);
+            reschedule();
+        } else {
+            // Held by another CPU, which can't touch the run queue to wake us
+            spinUnlock(&mutex->guard);
+            irqRestore(flags);
+            if (threadsRunning())
+                threadYield();
+            while (mutex->locked)
+                __asm__ __volatile__("rep; nop"); // pause
+            flags = irqSave();
+        }
+        spinLock(&mutex->guard);
+    }
+    mutex->locked = true;
+    mutex->owner = threadsRunning() ? current : NULL;
+    spinUnlock(&mutex->guard);
+    irqRestore(flags);
+}
+
+void mutexUnlock(Mutex *mutex) {
+    uint32_t flags = irqSave();
+    spinLock(&mutex->guard);
+    mutex->locked = false;
+    mutex->owner = NULL;
+    // The run queue is the boot CPU's. Another CPU leaves the waiters queued,
+    // the thread woken by the last thread to unlock passes the lock on to them
+    Thread *waiter = threadsRunning() ? mutex->waiters : NULL;
+    if (waiter)
+        mutex->waiters = waiter->next;
+    spinUnlock(&mutex->guard);
+    if (waiter) {
+        makeReady(waiter);
+        preempt();
+    }
+    irqRestore(flags);
+}
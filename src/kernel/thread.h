@@ -0,0 +1,86 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "../types.h"
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../cpu/spinlock.h"
+
+#define THREAD_PRIORITY_LOW    0
+#define THREAD_PRIORITY_NORMAL 1
+#define THREAD_PRIORITY_HIGH   2
+#define THREAD_PRIORITIES      3
+
+#define THREAD_STACK_SIZE 16384
+#define THREAD_TIMESLICE_MS 10
+
+#define THREAD_READY    0
+#define THREAD_RUNNING  1
+#define THREAD_SLEEPING 2
+#define THREAD_BLOCKED  3
+#define THREAD_DEAD     4
+#define THREAD_MUTEX_WAIT 5     // Queued on a Mutex, only mutexUnlock makes it ready
+
+typedef void (*ThreadEntry)(void *arg);
+
+typedef struct Thread {
+    uint32_t id;
+    char *name;
+    byte state;
+    byte priority;
+
+    registers_t *frame;     // Saved interrupt frame while the thread isn't running
+    void *stack;            // NULL for the boot thread, which keeps the boot stack
+    ThreadEntry entry;
+    void *arg;
+    Timer sleepTimer;       // Wakes the thread from threadSleep
+
+    struct Thread *next;    // Link in the run queue, sleep list or a wait list
+} Thread;
+
+/* A sleeping lock that excludes every CPU. Threads waiting for one held by
+ * another thread block; the other CPUs, and threads waiting for one held by
+ * another CPU, spin until it is free */
+typedef struct {
+    Spinlock guard;         // Protects the fields below, never held across a yield
+    volatile bool locked;
+    Thread *owner;          // NULL while a CPU without threads holds it
+    Thread *waiters;        // Blocked threads, only queued while a thread holds it
+} Mutex;
+
+/* Turn the running boot context into the first thread and set up the idle thread.
+ * Everything else in here is a no-op until this has been called, and stays one on
+ * the other CPUs: threads only run on the boot CPU */
+void threadInit();
+
+/* Start running `entry(arg)` on its own stack. The thread exits when entry returns */
+Thread *threadCreate(char *name, ThreadEntry entry, void *arg, byte priority);
+
+Thread *threadCurrent();
+
+/* Let other ready threads of the same or higher priority run */
+void threadYield();
+
+/* Sleep for at least `ms` milliseconds */
+void threadSleep(uint32_t ms);
+
+/* Stop running until another thread or an IRQ calls threadWake. To wait for a
+ * condition without losing a wakeup, check it with interrupts disabled and call
+ * this before enabling them again */
+void threadBlock();
+
+/* Make a thread stopped in threadBlock ready again, safe to call from IRQs.
+ * Does nothing to a thread that is running, sleeping or waiting on a Mutex */
+void threadWake(Thread *thread);
+
+/* Stop the calling thread, its stack is freed once another thread runs */
+void threadExit();
+
+/* Called at the end of every IRQ, returns the frame of the thread to resume */
+registers_t *threadIrqExit(registers_t *frame);
+
+void mutexInit(Mutex *mutex);
+void mutexLock(Mutex *mutex);
+void mutexUnlock(Mutex *mutex);
+
+#endif // THREAD_H
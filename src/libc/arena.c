@@ -0,0 +1,76 @@
+#include "arena.h"
+#include "mem.h"
+
+static ArenaChunk *newChunk(ArenaChunk *prev, uint32_t size) {
+    ArenaChunk *chunk = (ArenaChunk *)malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->prev = prev;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+bool arenaInit(Arena *arena, uint32_t chunkSize) {
+    arena->chunkSize = chunkSize;
+    arena->current = newChunk(NULL, chunkSize);
+    return arena->current != NULL;
+}
+
+// Offset into `chunk` of the next ARENA_ALIGNMENT aligned address
+static inline uint32_t alignedOffset(ArenaChunk *chunk) {
+    uint32_t base = (uint32_t)(chunk + 1);
+    return ((base + chunk->used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1)) - base;
+}
+
+void *arenaAlloc(Arena *arena, uint32_t nbytes) {
+    ArenaChunk *chunk = arena->current;
+
+    if (chunk == NULL || alignedOffset(chunk) + nbytes > chunk->size) {
+        // Overflow into a new chunk, big enough for at least this request
+        uint32_t size = nbytes + ARENA_ALIGNMENT;
+        chunk = newChunk(chunk, size > arena->chunkSize ? size : arena->chunkSize);
+        if (chunk == NULL)
+            return NULL;
+        arena->current = chunk;
+    }
+
+    uint32_t offset = alignedOffset(chunk);
+    chunk->used = offset + nbytes;
+    return (byte *)(chunk + 1) + offset;
+}
+
+ArenaMark arenaPush(Arena *arena) {
+    ArenaMark mark;
+    mark.chunk = arena->current;
+    mark.used = arena->current ? arena->current->used : 0;
+    return mark;
+}
+
+void arenaPop(Arena *arena, ArenaMark mark) {
+    while (arena->current != mark.chunk) {
+        ArenaChunk *prev = arena->current->prev;
+        free((void *)arena->current);
+        arena->current = prev;
+    }
+    if (arena->current)
+        arena->current->used = mark.used;
+}
+
+void arenaReset(Arena *arena) {
+    if (arena->current == NULL)
+        return;
+    while (arena->current->prev != NULL) {
+        ArenaChunk *prev = arena->current->prev;
+        free((void *)arena->current);
+        arena->current = prev;
+    }
+    arena->current->used = 0;
+}
+
+void arenaDestroy(Arena *arena) {
+    arenaReset(arena);
+    if (arena->current)
+        free((void *)arena->current);
+    arena->current = NULL;
+}
@@ -0,0 +1,47 @@
+#if !defined(ARENA_H)
+#define ARENA_H
+
+#include "../types.h"
+
+/* A bump allocator for short-lived temporaries. Memory comes from the heap in
+ * chunks; allocating is a pointer bump, and everything allocated after a mark
+ * is released at once by popping back to it. */
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *prev;
+    uint32_t size;      // Usable bytes after the header
+    uint32_t used;
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *current;
+    uint32_t chunkSize;  // Size of the first chunk, and the minimum for overflow chunks
+} Arena;
+
+typedef struct {
+    ArenaChunk *chunk;
+    uint32_t used;
+} ArenaMark;
+
+/* Set up an arena whose first chunk holds `chunkSize` bytes.
+ * The first chunk is kept across resets */
+bool arenaInit(Arena *arena, uint32_t chunkSize);
+
+/* Allocate `nbytes` bytes, aligned to ARENA_ALIGNMENT. Returns NULL if the heap is exhausted */
+void *arenaAlloc(Arena *arena, uint32_t nbytes);
+
+/* Remember the current position, to release everything allocated after it with arenaPop */
+ArenaMark arenaPush(Arena *arena);
+
+/* Release everything allocated since `mark` was taken */
+void arenaPop(Arena *arena, ArenaMark mark);
+
+/* Release every allocation, keeping the first chunk for reuse */
+void arenaReset(Arena *arena);
+
+/* Return all of the arena's memory to the heap */
+void arenaDestroy(Arena *arena);
+
+#endif // ARENA_H
@@ -1,28 +1,259 @@
 #include "mem.h"
 #include "../debug.h"
+#include "printf.h"
+#include "../cpu/utils.h"
+#include "../cpu/spinlock.h"
+
+// Size classes for picking a copy/fill/compare strategy at runtime.
+// Below MEM_WORD_THRESHOLD the setup cost of anything clever isn't worth it,
+// `rep movsd/stosd` wins once its startup cost is amortized, and SSE2 only
+// pays off for cluster-sized buffers.
+#define MEM_WORD_THRESHOLD 16
+#define MEM_REP_THRESHOLD  128
+#define MEM_SSE_THRESHOLD  512
+
+static bool sseEnabled = false;
+
+void memEnableSSE() {
+    sseEnabled = true;
+}
+
+// Interrupt handlers and thread switches don't save the XMM registers, so the
+// SSE loops run with interrupts disabled to keep anyone else from clobbering them.
+
+static inline void copyBytes(char *source, char *dest, uint32_t nbytes) {
+    while (nbytes--)
+        *dest++ = *source++;
+}
+
+static void copyWords(char *source, char *dest, uint32_t nbytes) {
+    while (((uint32_t)dest & 3) != 0) {
+        *dest++ = *source++;
+        nbytes--;
+    }
+    uint32_t *d = (uint32_t *)dest;
+    uint32_t *s = (uint32_t *)source;
+    for (; nbytes >= 16; nbytes -= 16) {
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+        d[3] = s[3];
+        d += 4;
+        s += 4;
+    }
+    for (; nbytes >= 4; nbytes -= 4)
+        *d++ = *s++;
+    copyBytes((char *)s, (char *)d, nbytes);
+}
+
+static void copyRep(char *source, char *dest, uint32_t nbytes) {
+    while (((uint32_t)dest & 3) != 0 && nbytes > 0) {
+        *dest++ = *source++;
+        nbytes--;
+    }
+    uint32_t dwords = nbytes >> 2;
+    __asm__ __volatile__("rep movsl" : "+S" (source), "+D" (dest), "+c" (dwords) : : "memory");
+    copyBytes(source, dest, nbytes & 3);
+}
+
+static void copySSE(char *source, char *dest, uint32_t nbytes) {
+    while (((uint32_t)dest & 15) != 0) {
+        *dest++ = *source++;
+        nbytes--;
+    }
+    uint32_t blocks = nbytes >> 6;
+    uint32_t flags = irqSave();
+    // The kernel is built without SSE code generation, so the XMM registers
+    // can't (and needn't) be listed as clobbers.
+    __asm__ __volatile__(
+        "1:\n\t"
+        "movdqu   (%0), %%xmm0\n\t"
+        "movdqu 16(%0), %%xmm1\n\t"
+        "movdqu 32(%0), %%xmm2\n\t"
+        "movdqu 48(%0), %%xmm3\n\t"
+        "movdqa %%xmm0,   (%1)\n\t"
+        "movdqa %%xmm1, 16(%1)\n\t"
+        "movdqa %%xmm2, 32(%1)\n\t"
+        "movdqa %%xmm3, 48(%1)\n\t"
+        "addl $64, %0\n\t"
+        "addl $64, %1\n\t"
+        "decl %2\n\t"
+        "jnz 1b"
+        : "+r" (source), "+r" (dest), "+r" (blocks) : : "memory", "cc");
+    irqRestore(flags);
+    copyRep(source, dest, nbytes & 63);
+}
 
 void memcpy(char *source, char *dest, int nbytes) {
-    int i;
-    for (i = 0; i < nbytes; i++) {
-        *(dest + i) = *(source + i);
+    if (nbytes <= 0)
+        return;
+    uint32_t n = (uint32_t)nbytes;
+    if (n < MEM_WORD_THRESHOLD)
+        copyBytes(source, dest, n);
+    else if (n < MEM_REP_THRESHOLD)
+        copyWords(source, dest, n);
+    else if (n < MEM_SSE_THRESHOLD || !sseEnabled)
+        copyRep(source, dest, n);
+    else
+        copySSE(source, dest, n);
+}
+
+void memmove(char *source, char *dest, int nbytes) {
+    if (nbytes <= 0 || source == dest)
+        return;
+    // Every forward strategy reads a chunk before writing it, so a forward
+    // copy is safe whenever the destination starts below the source.
+    if (dest < source || dest >= source + nbytes) {
+        memcpy(source, dest, nbytes);
+        return;
+    }
+    uint32_t n = (uint32_t)nbytes;
+    source += n;
+    dest += n;
+    while ((n & 3) != 0) {
+        *--dest = *--source;
+        n--;
+    }
+    uint32_t *d = (uint32_t *)dest;
+    uint32_t *s = (uint32_t *)source;
+    for (; n >= 4; n -= 4)
+        *--d = *--s;
+}
+
+static void setWords(char *dest, uint32_t pattern, uint32_t nbytes) {
+    while (((uint32_t)dest & 3) != 0) {
+        *dest++ = (char)pattern;
+        nbytes--;
+    }
+    uint32_t *d = (uint32_t *)dest;
+    for (; nbytes >= 16; nbytes -= 16) {
+        d[0] = pattern;
+        d[1] = pattern;
+        d[2] = pattern;
+        d[3] = pattern;
+        d += 4;
+    }
+    for (; nbytes >= 4; nbytes -= 4)
+        *d++ = pattern;
+    dest = (char *)d;
+    while (nbytes--)
+        *dest++ = (char)pattern;
+}
+
+static void setRep(char *dest, uint32_t pattern, uint32_t nbytes) {
+    while (((uint32_t)dest & 3) != 0 && nbytes > 0) {
+        *dest++ = (char)pattern;
+        nbytes--;
     }
+    uint32_t dwords = nbytes >> 2;
+    __asm__ __volatile__("rep stosl" : "+D" (dest), "+c" (dwords) : "a" (pattern) : "memory");
+    for (nbytes &= 3; nbytes > 0; nbytes--)
+        *dest++ = (char)pattern;
+}
+
+static void setSSE(char *dest, uint32_t pattern, uint32_t nbytes) {
+    while (((uint32_t)dest & 15) != 0) {
+        *dest++ = (char)pattern;
+        nbytes--;
+    }
+    uint32_t blocks = nbytes >> 6;
+    uint32_t flags = irqSave();
+    __asm__ __volatile__(
+        "movd %2, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"
+        "1:\n\t"
+        "movdqa %%xmm0,   (%0)\n\t"
+        "movdqa %%xmm0, 16(%0)\n\t"
+        "movdqa %%xmm0, 32(%0)\n\t"
+        "movdqa %%xmm0, 48(%0)\n\t"
+        "addl $64, %0\n\t"
+        "decl %1\n\t"
+        "jnz 1b"
+        : "+r" (dest), "+r" (blocks) : "r" (pattern) : "memory", "cc");
+    irqRestore(flags);
+    setRep(dest, pattern, nbytes & 63);
 }
 
 void memset(char *dest, char val, int nbytes) {
-    int i;
-    for (i = 0; i < nbytes; i++) {
-        *(dest + i) = val;
+    if (nbytes <= 0)
+        return;
+    uint32_t n = (uint32_t)nbytes;
+    uint32_t pattern = (uint8_t)val * 0x01010101;
+    if (n < MEM_WORD_THRESHOLD) {
+        while (n--)
+            *dest++ = val;
+    } else if (n < MEM_REP_THRESHOLD) {
+        setWords(dest, pattern, n);
+    } else if (n < MEM_SSE_THRESHOLD || !sseEnabled) {
+        setRep(dest, pattern, n);
+    } else {
+        setSSE(dest, pattern, n);
     }
 }
 
-bool memequal(char *a, char *b, int nbytes) {
-    for (int i = 0; i < nbytes; i++) {
+static bool equalBytes(char *a, char *b, uint32_t nbytes) {
+    for (uint32_t i = 0; i < nbytes; i++) {
         if (a[i] != b[i])
             return false;
     }
     return true;
 }
 
+static bool equalWords(char *a, char *b, uint32_t nbytes) {
+    uint32_t *wa = (uint32_t *)a;
+    uint32_t *wb = (uint32_t *)b;
+    for (; nbytes >= 16; nbytes -= 16) {
+        if ((wa[0] ^ wb[0]) | (wa[1] ^ wb[1]) | (wa[2] ^ wb[2]) | (wa[3] ^ wb[3]))
+            return false;
+        wa += 4;
+        wb += 4;
+    }
+    for (; nbytes >= 4; nbytes -= 4) {
+        if (*wa++ != *wb++)
+            return false;
+    }
+    return equalBytes((char *)wa, (char *)wb, nbytes);
+}
+
+static bool equalSSE(char *a, char *b, uint32_t nbytes) {
+    uint32_t blocks = nbytes >> 5;
+    uint32_t mask;
+    uint32_t flags = irqSave();
+    __asm__ __volatile__(
+        "1:\n\t"
+        "movdqu   (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu   (%2), %%xmm2\n\t"
+        "movdqu 16(%2), %%xmm3\n\t"
+        "pcmpeqb %%xmm2, %%xmm0\n\t"
+        "pcmpeqb %%xmm3, %%xmm1\n\t"
+        "pand %%xmm1, %%xmm0\n\t"
+        "pmovmskb %%xmm0, %0\n\t"
+        "cmpl $0xFFFF, %0\n\t"
+        "jne 2f\n\t"
+        "addl $32, %1\n\t"
+        "addl $32, %2\n\t"
+        "decl %3\n\t"
+        "jnz 1b\n\t"
+        "2:"
+        : "=&r" (mask), "+r" (a), "+r" (b), "+r" (blocks) : : "memory", "cc");
+    irqRestore(flags);
+    if (mask != 0xFFFF)
+        return false;
+    return equalWords(a, b, nbytes & 31);
+}
+
+bool memequal(char *a, char *b, int nbytes) {
+    if (nbytes <= 0)
+        return true;
+    uint32_t n = (uint32_t)nbytes;
+    if (n < MEM_WORD_THRESHOLD)
+        return equalBytes(a, b, n);
+    if (n < MEM_SSE_THRESHOLD || !sseEnabled)
+        return equalWords(a, b, n);
+    return equalSSE(a, b, n);
+}
+
 static void *find(uint32_t nbytes);
 
 static void optimize();
@@ -32,121 +263,340 @@ static void split(void *block, uint32_t nbytes);
 static void *biggestBlock = NULL;
 static void *lastBlock = NULL;
 
-void *malloc(uint32_t nbytes) {
+static MemStats counters;
+#ifdef MALLOC_TRACK_CALLERS
+static MemCallSite callSites[MALLOC_CALL_SITES];
+#endif
+
+static inline uint32_t sizeClass(uint32_t nbytes) {
+    if (nbytes <= 16)
+        return 0;
+    uint32_t cls = 32 - __builtin_clz(nbytes - 1) - 4;
+    return cls < MALLOC_SIZE_CLASSES ? cls : MALLOC_SIZE_CLASSES - 1;
+}
+
+#ifdef MALLOC_TRACK_CALLERS
+// Call sites that don't fit in the table are all counted in the last slot
+static MemCallSite *findCallSite(void *caller) {
+    uint32_t i;
+    for (i = 0; i < MALLOC_CALL_SITES - 1; i++) {
+        if (callSites[i].caller == caller)
+            return &callSites[i];
+        if (callSites[i].caller == NULL) {
+            callSites[i].caller = caller;
+            return &callSites[i];
+        }
+    }
+    return &callSites[i];
+}
+#endif
+
+static void statsAllocated(void *ptr, void *caller) {
+    BlockHeader *header = (BlockHeader *)(ptr - MALLOC_BLOCK_HEADER_LENGTH);
+    uint32_t bytes = header->blockSize - MALLOC_BLOCK_HEADER_LENGTH;
+    counters.bytesInUse += bytes;
+    if (counters.bytesInUse > counters.peakBytesInUse)
+        counters.peakBytesInUse = counters.bytesInUse;
+    counters.liveBlocks++;
+    counters.allocations++;
+    counters.sizeClassCounts[sizeClass(bytes)]++;
+#ifdef MALLOC_TRACK_CALLERS
+    header->caller = caller;
+    MemCallSite *site = findCallSite(caller);
+    site->allocations++;
+    site->liveBlocks++;
+    site->liveBytes += bytes;
+#endif
+}
+
+static void statsFreed(BlockHeader *header) {
+    uint32_t bytes = header->blockSize - MALLOC_BLOCK_HEADER_LENGTH;
+    counters.bytesInUse -= bytes;
+    counters.liveBlocks--;
+    counters.frees++;
+#ifdef MALLOC_TRACK_CALLERS
+    MemCallSite *site = findCallSite(header->caller);
+    site->liveBlocks--;
+    site->liveBytes -= bytes;
+#endif
+}
+
+static void statsResized(BlockHeader *header, uint32_t oldBytes) {
+    uint32_t bytes = header->blockSize - MALLOC_BLOCK_HEADER_LENGTH;
+    counters.bytesInUse += bytes - oldBytes;
+    if (counters.bytesInUse > counters.peakBytesInUse)
+        counters.peakBytesInUse = counters.bytesInUse;
+#ifdef MALLOC_TRACK_CALLERS
+    findCallSite(header->caller)->liveBytes += bytes - oldBytes;
+#endif
+}
+
+// A header whose size can't even hold itself marks the end of the heap,
+// everything past it is unused. Allocated blocks therefore hold at least one byte.
+static inline bool isEndBlock(BlockHeader *header) {
+    return header->blockSize <= MALLOC_BLOCK_HEADER_LENGTH;
+}
+
+static inline BlockHeader *nextBlockHeader(BlockHeader *header) {
+    return (BlockHeader *)((void *)header + header->blockSize);
+}
+
+static inline void markEndBlock(BlockHeader *header) {
+    header->flags = 0;
+    header->blockSize = 0;
+}
+
+// Melt as many following free blocks as possible into this one
+static void absorbFreeBlocks(BlockHeader *header) {
+    BlockHeader *next = nextBlockHeader(header);
+    while ((next->flags & 1) == 0 && !isEndBlock(next)) {
+        header->blockSize += next->blockSize;
+        next = nextBlockHeader(header);
+    }
+}
+
+// Shrink `block` to hold `nbytes`, the excess becomes a free block if it is big enough to be one
+static void split(void *block, uint32_t nbytes) {
+    BlockHeader *header = (BlockHeader *)block;
+    uint32_t size = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
+    if (header->blockSize <= size + MALLOC_BLOCK_HEADER_LENGTH)
+        return;
+
+    BlockHeader *rest = (BlockHeader *)(block + size);
+    rest->flags = 0;
+    rest->blockSize = header->blockSize - size;
+    header->blockSize = size;
+}
+
+// Turn the last block into an allocation of `nbytes`, moving the end of the heap behind it
+static void *allocateAtEnd(BlockHeader *header, uint32_t nbytes) {
+    header->flags = 1;
+    header->blockSize = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
+    markEndBlock(nextBlockHeader(header));
+    return (void *)header + MALLOC_BLOCK_HEADER_LENGTH;
+}
+
+static void *allocate(uint32_t nbytes) {
     // LOG("Requested allocation of "); LOG_INT(nbytes); LOG(" bytes\n");
 
-    void *block = MALLOC_BEGIN_ADDR;
-    uint8_t *flags;
-    uint32_t *blockSize;
+    if (nbytes == 0)
+        nbytes = 1;
 
-    void *nextBlock;
-    uint8_t *nextFlags;
-    uint32_t *nextBlockSize;
+    void *block = MALLOC_BEGIN_ADDR;
+    BlockHeader *header;
 
     while (true) {
-        flags = (uint8_t *)block;
-        blockSize = (uint32_t *)(block+1);
-        
+        header = (BlockHeader *)block;
+
         // LOG("  Checking block at "); // LOG is part of my header `debug.h`
         // LOG_INT(block);
         // LOG(": ");
         // LOG("flags=");
-        // LOG_BYTE(*flags);
+        // LOG_BYTE(header->flags);
         // LOG(", bytes=");
-        // LOG_INT(*blockSize - MALLOC_BLOCK_HEADER_LENGTH);
+        // LOG_INT(header->blockSize - MALLOC_BLOCK_HEADER_LENGTH);
         // LOG("...");
-        if ((*flags & 1) != 0)
+        if ((header->flags & 1) != 0)
         {
             // LOG(" Not a free block\n");
-            block += *blockSize;
+            block += header->blockSize;
             continue;
         }
         // LOG(" Is a free block\n  ");
 
-        // Melt as many following free blocks as possible into this one
-        nextBlock = block + *blockSize;
-        nextFlags = (uint8_t *)nextBlock;
-        nextBlockSize = (uint32_t *)(nextBlock+1);
-        if (*nextBlockSize <= MALLOC_BLOCK_HEADER_LENGTH) { // last block
+        if (isEndBlock(header) || isEndBlock(nextBlockHeader(header))) { // last block
             // LOG("Is last block, extending...\n");
-            *(uint8_t *)block = 1;
-            *(uint32_t *)(block+1) = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
-            return block + MALLOC_BLOCK_HEADER_LENGTH;
+            return allocateAtEnd(header, nbytes);
         }
-        uint32_t melted = 0;
-        while ((*nextFlags & 1) == 0 && *nextBlockSize > MALLOC_BLOCK_HEADER_LENGTH)
-        {
-            *blockSize += *nextBlockSize;
 
-            nextBlock += *nextBlockSize;
-            nextFlags = (uint8_t *)nextBlock;
-            nextBlockSize = (uint32_t *)(nextBlock+1);
-            melted++;
-        }
-        // LOG_INT(melted); LOG(" melted, ");
-        if (*blockSize - MALLOC_BLOCK_HEADER_LENGTH < nbytes && *blockSize > MALLOC_BLOCK_HEADER_LENGTH)
+        absorbFreeBlocks(header);
+        if (header->blockSize - MALLOC_BLOCK_HEADER_LENGTH < nbytes)
         {
             // LOG("Too small\n");
-            block += *blockSize;
+            block += header->blockSize;
             continue;
         }
 
         // LOG("Big enough to allocate, splitting block\n");
+        split(block, nbytes);
+        header->flags = 1;
+        return block + MALLOC_BLOCK_HEADER_LENGTH;
+    }
+    // LOG("\n");
+}
 
-        if (*blockSize > nbytes+MALLOC_BLOCK_HEADER_LENGTH) {
-            // Calculate the size of the remaining free block
-            uint32_t remainingBlockSize = *blockSize - (nbytes + MALLOC_BLOCK_HEADER_LENGTH);
+// The heap is shared by every thread and CPU and used from interrupt handlers,
+// so the public functions only touch it holding heapLock with interrupts disabled.
 
-            // Update the size of the allocated block
-            *blockSize = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
+static Spinlock heapLock = SPINLOCK_INIT;
 
-            // Update the next block's header to reflect the remaining free block
-            uint8_t *nextBlock = block + nbytes + MALLOC_BLOCK_HEADER_LENGTH;
-            *(uint8_t *)nextBlock = 0; // Set the flag for a free block
-            *(uint32_t *)(nextBlock + 1) = remainingBlockSize;
+static void release(BlockHeader *header) {
+    statsFreed(header);
+    header->flags &= ~1;
 
-            // LOG("Block split, allocated "); LOG_INT(nbytes); LOG(" bytes, saved "); LOG_INT(remainingBlockSize); LOG("\n");
-        } else {
-            // LOG("Not enough excess to split the block\n");
+    if (isEndBlock(nextBlockHeader(header))) {
+        header->blockSize = 0;
+    }
+}
+
+void *malloc(uint32_t nbytes) {
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    void *ptr = allocate(nbytes);
+    statsAllocated(ptr, __builtin_return_address(0));
+    spinUnlockIrqRestore(&heapLock, flags);
+    return ptr;
+}
+
+void *calloc(uint32_t count, uint32_t size) {
+    // The product would wrap and hand back a smaller block than asked for
+    if (size != 0 && count > 0xFFFFFFFF / size)
+        return NULL;
+    uint32_t nbytes = count * size;
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    void *ptr = allocate(nbytes);
+    statsAllocated(ptr, __builtin_return_address(0));
+    spinUnlockIrqRestore(&heapLock, flags);
+    memset((char *)ptr, 0, nbytes);
+    return ptr;
+}
+
+static void *reallocate(void *ptr, uint32_t nbytes, void *caller) {
+    if (ptr == NULL) {
+        ptr = allocate(nbytes);
+        statsAllocated(ptr, caller);
+        return ptr;
+    }
+    if (nbytes == 0) {
+        release((BlockHeader *)(ptr - MALLOC_BLOCK_HEADER_LENGTH));
+        return NULL;
+    }
+
+    BlockHeader *header = (BlockHeader *)(ptr - MALLOC_BLOCK_HEADER_LENGTH);
+    uint32_t oldBytes = header->blockSize - MALLOC_BLOCK_HEADER_LENGTH;
+    uint32_t needed = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
+    bool resized = false;
+
+    if (header->blockSize < needed) {
+        // Try to grow in place, into free successors or the unused end of the heap
+        absorbFreeBlocks(header);
+        if (header->blockSize < needed && isEndBlock(nextBlockHeader(header))) {
+            allocateAtEnd(header, nbytes);
+            resized = true;
         }
+    } else if (isEndBlock(nextBlockHeader(header))) {
+        allocateAtEnd(header, nbytes);
+        resized = true;
+    }
 
-        *(uint8_t *)block = 1;
-        *(uint32_t *)(block+1) = nbytes + MALLOC_BLOCK_HEADER_LENGTH;
-        return block + MALLOC_BLOCK_HEADER_LENGTH;
+    if (!resized && header->blockSize >= needed) {
+        split((void *)header, nbytes);
+        resized = true;
     }
-    // LOG("\n");
+    // Successors absorbed above belong to this block until it is freed
+    statsResized(header, oldBytes);
+    if (resized)
+        return ptr;
+
+    void *moved = allocate(nbytes);
+    statsAllocated(moved, caller);
+    memcpy((char *)ptr, (char *)moved, oldBytes);
+    release(header);
+    return moved;
+}
+
+void *realloc(void *ptr, uint32_t nbytes) {
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    ptr = reallocate(ptr, nbytes, __builtin_return_address(0));
+    spinUnlockIrqRestore(&heapLock, flags);
+    return ptr;
+}
+
+static void *allocateAligned(uint32_t alignment, uint32_t nbytes) {
+    if (alignment <= 1)
+        return allocate(nbytes);
+    if (nbytes == 0)
+        nbytes = 1;
+
+    void *block = MALLOC_BEGIN_ADDR;
+    BlockHeader *header;
+
+    while (true) {
+        header = (BlockHeader *)block;
+        if ((header->flags & 1) != 0) {
+            block += header->blockSize;
+            continue;
+        }
+
+        bool last = isEndBlock(header);
+        if (!last) {
+            absorbFreeBlocks(header);
+            last = isEndBlock(nextBlockHeader(header));
+        }
+
+        // Place the data on the first aligned address whose leading gap is either
+        // empty or big enough to stay behind as a free block of its own
+        uint32_t data = (uint32_t)block + MALLOC_BLOCK_HEADER_LENGTH;
+        uint32_t aligned = (data + alignment - 1) & ~(alignment - 1);
+        while (aligned != data && aligned - data <= MALLOC_BLOCK_HEADER_LENGTH)
+            aligned += alignment;
+        uint32_t gap = aligned - data;
+
+        if (!last && header->blockSize - MALLOC_BLOCK_HEADER_LENGTH < gap + nbytes) {
+            block += header->blockSize;
+            continue;
+        }
+
+        BlockHeader *allocated = (BlockHeader *)(block + gap);
+        if (last) {
+            if (gap > 0)
+                header->blockSize = gap;
+            return allocateAtEnd(allocated, nbytes);
+        }
+
+        uint32_t size = header->blockSize;
+        if (gap > 0) {
+            header->blockSize = gap;
+            allocated->blockSize = size - gap;
+        }
+        split((void *)allocated, nbytes);
+        allocated->flags = 1;
+        return (void *)aligned;
+    }
+}
+
+void *memalign(uint32_t alignment, uint32_t nbytes) {
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    void *ptr = allocateAligned(alignment, nbytes);
+    statsAllocated(ptr, __builtin_return_address(0));
+    spinUnlockIrqRestore(&heapLock, flags);
+    return ptr;
 }
 
 void free(void *ptr) {
+    if (ptr == NULL)
+        return;
     void *block = ptr - MALLOC_BLOCK_HEADER_LENGTH;
     // LOG("Requested deallocation\n");
-    uint8_t *flags = (uint8_t *)block;
-    uint32_t *blockSize = (uint32_t *)(block+1);
+    BlockHeader *header = (BlockHeader *)block;
     // LOG("  ");
     // LOG("addr=");
     // LOG_INT(block);
     // LOG(", flags=");
-    // LOG_BYTE(*flags);
+    // LOG_BYTE(header->flags);
     // LOG(", bytes=");
-    // LOG_INT(*blockSize - MALLOC_BLOCK_HEADER_LENGTH);
+    // LOG_INT(header->blockSize - MALLOC_BLOCK_HEADER_LENGTH);
     // LOG("\n");
 
-    *flags &= ~1;
-
-    void *nextBlock = block + *blockSize;
-    uint8_t *nextFlags = (uint8_t *)nextBlock;
-    uint32_t *nextBlockSize = (uint32_t *)(nextBlock+1);
-    if (*nextBlockSize <= MALLOC_BLOCK_HEADER_LENGTH) {
-        *blockSize = 0;
-    }
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    release(header);
+    spinUnlockIrqRestore(&heapLock, flags);
 }
 
 void printMemoryInfo() {
     void *currentBlock = MALLOC_BEGIN_ADDR;
     BlockHeader *header;
 
-    LOG("Memory Blocks Information:\n");
-    uint32_t i = 0;
+    LOG_INFO(LOG_CAT_MEMORY, "Memory blocks:");
     bool allocated;
     bool reserved;
     while (true) {
@@ -157,23 +607,83 @@ void printMemoryInfo() {
             break;
         }
 
-        LOG("  BLK "); LOG_INT(++i); LOG(" <"); LOG_INT(currentBlock); LOG("> ");
-        LOG_INT(header->blockSize); LOG("(");
-        LOG_INT(header->blockSize - MALLOC_BLOCK_HEADER_LENGTH); LOG(") bytes      ");
-
         allocated = ((header->flags) & 1);
         reserved = ((header->flags) & 2) > 0;
 
-        if (reserved) {
-            LOG("<Reserved>");
-        } else if (allocated) {
-            LOG("<Allocated>");
-        } else {
-            LOG("<Free>");
-        }
-        
-        LOG("\n");
+        LOG_INFO(LOG_CAT_MEMORY, "  BLK <%x> %u bytes <%s>", currentBlock,
+                 header->blockSize - MALLOC_BLOCK_HEADER_LENGTH,
+                 reserved ? "Reserved" : allocated ? "Allocated" : "Free");
         // Move to the next block
         currentBlock += header->blockSize;
     }
-}
\ No newline at end of file
+}
+
+void memGetStats(MemStats *stats) {
+    uint32_t flags = spinLockIrqSave(&heapLock);
+    *stats = counters;
+    stats->freeBytes = 0;
+    stats->freeBlocks = 0;
+    stats->largestFreeBlock = 0;
+
+    BlockHeader *header = (BlockHeader *)MALLOC_BEGIN_ADDR;
+    while (!isEndBlock(header)) {
+        if ((header->flags & 1) == 0) {
+            uint32_t bytes = header->blockSize - MALLOC_BLOCK_HEADER_LENGTH;
+            stats->freeBytes += bytes;
+            stats->freeBlocks++;
+            if (bytes > stats->largestFreeBlock)
+                stats->largestFreeBlock = bytes;
+        }
+        header = nextBlockHeader(header);
+    }
+    stats->heapBytes = (uint32_t)header - (uint32_t)MALLOC_BEGIN_ADDR;
+    spinUnlockIrqRestore(&heapLock, flags);
+
+    // Adjacent free blocks are only melted lazily, so this overestimates a bit
+    if (stats->freeBytes == 0)
+        stats->fragmentationPercent = 0;
+    else if (stats->freeBytes < 0x01000000)
+        stats->fragmentationPercent = 100 - stats->largestFreeBlock * 100 / stats->freeBytes;
+    else
+        stats->fragmentationPercent = 100 - (stats->largestFreeBlock >> 8) * 100 / (stats->freeBytes >> 8);
+}
+
+uint32_t memGetCallSites(MemCallSite *sites, uint32_t max) {
+    uint32_t count = 0;
+#ifdef MALLOC_TRACK_CALLERS
+    for (uint32_t i = 0; i < MALLOC_CALL_SITES && callSites[i].caller != NULL; i++) {
+        if (count < max)
+            sites[count] = callSites[i];
+        count++;
+    }
+#endif
+    return count;
+}
+
+void memDumpStats() {
+    MemStats stats;
+    memGetStats(&stats);
+
+    serialPrintf("heap: %u B in use, peak %u B, %u live blocks, %u allocs, %u frees\n",
+                 stats.bytesInUse, stats.peakBytesInUse, stats.liveBlocks, stats.allocations, stats.frees);
+    serialPrintf("heap: %u B span, %u B free in %u blocks, largest %u B, fragmentation %u%%\n",
+                 stats.heapBytes, stats.freeBytes, stats.freeBlocks, stats.largestFreeBlock,
+                 stats.fragmentationPercent);
+
+    char line[PRINTF_LINE_LENGTH];
+    uint32_t length = snprintf(line, sizeof(line), "heap size classes:");
+    for (uint32_t i = 0; i < MALLOC_SIZE_CLASSES && length < sizeof(line); i++) {
+        length += snprintf(line + length, sizeof(line) - length, " %s%u:%u",
+                           i == MALLOC_SIZE_CLASSES - 1 ? ">" : "<=",
+                           16 << (i == MALLOC_SIZE_CLASSES - 1 ? i - 1 : i), stats.sizeClassCounts[i]);
+    }
+    serialPrintf("%s\n", line);
+
+#ifdef MALLOC_TRACK_CALLERS
+    for (uint32_t i = 0; i < MALLOC_CALL_SITES && callSites[i].caller != NULL; i++) {
+        serialPrintf("heap caller %p%s: %u allocs, %u live, %u B\n", callSites[i].caller,
+                     i == MALLOC_CALL_SITES - 1 ? " (and others)" : "",
+                     callSites[i].allocations, callSites[i].liveBlocks, callSites[i].liveBytes);
+    }
+#endif
+}
@@ -3,26 +3,87 @@
 
 #include "../types.h"
 
+// Record the return address of every allocation in its block header, and keep
+// per-call-site counters. Costs 4 bytes per block.
+// #define MALLOC_TRACK_CALLERS
+
 typedef struct {
     uint8_t flags;      // Allocation status flags
     // bit 0: occupied
     // bit 1: reserved
     uint32_t blockSize;  // Size of the block, including the header
+#ifdef MALLOC_TRACK_CALLERS
+    void *caller;       // Return address of the call that allocated the block
+#endif
 }__attribute__((packed)) BlockHeader;
 
 #define MALLOC_BEGIN_ADDR (void*)0x00100000
 #define MALLOC_BLOCK_HEADER_LENGTH (sizeof(BlockHeader))
 
+// Allocations are counted in power-of-two size classes: <=16, <=32, ... <=32K, bigger
+#define MALLOC_SIZE_CLASSES 13
+#define MALLOC_CALL_SITES 32
+
+typedef struct {
+    // Always-on counters, updated by every heap call
+    uint32_t bytesInUse;        // Usable bytes of all allocated blocks
+    uint32_t peakBytesInUse;
+    uint32_t liveBlocks;
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t sizeClassCounts[MALLOC_SIZE_CLASSES];
+
+    // Filled in by walking the heap in memGetStats
+    uint32_t heapBytes;         // From MALLOC_BEGIN_ADDR to the end of the last block
+    uint32_t freeBytes;
+    uint32_t freeBlocks;
+    uint32_t largestFreeBlock;
+    uint32_t fragmentationPercent; // 100 * (1 - largestFreeBlock / freeBytes)
+} MemStats;
+
+typedef struct {
+    void *caller;
+    uint32_t allocations;
+    uint32_t liveBlocks;
+    uint32_t liveBytes;
+} MemCallSite;
+
 /* copy `nbytes` bytes to `*source`, starting at `*dest` */
 void memcpy(char *source, char *dest, int nbytes);
 
+/* same as memcpy, but the two regions may overlap */
+void memmove(char *source, char *dest, int nbytes);
+
 /* set the value of `nbytes` bytes to `val`, starting at `*dest` */
 void memset(char *dest, char val, int nbytes);
 
 bool memequal(char *a, char *b, int nbytes);
 
+/* Allow the mem* functions to use SSE2, called once the FPU/SSE is enabled */
+void memEnableSSE();
+
 void* malloc(uint32_t nbytes);
 
+/* allocate `count * size` zeroed bytes */
+void* calloc(uint32_t count, uint32_t size);
+
+/* resize an allocation, growing in place into free successor blocks when possible */
+void* realloc(void *ptr, uint32_t nbytes);
+
+/* allocate `nbytes` bytes starting at a multiple of `alignment` (a power of two),
+ * the skipped space before it stays a free block */
+void* memalign(uint32_t alignment, uint32_t nbytes);
+
 void free(void *block);
 
+/* Snapshot the allocator counters and compute the fragmentation figures */
+void memGetStats(MemStats *stats);
+
+/* Copy up to `max` call sites into `sites` and return how many there were.
+ * Always 0 unless built with MALLOC_TRACK_CALLERS */
+uint32_t memGetCallSites(MemCallSite *sites, uint32_t max);
+
+/* Print the allocator statistics over the serial port */
+void memDumpStats();
+
 #endif // MEM_H
\ No newline at end of file
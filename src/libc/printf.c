@@ -0,0 +1,198 @@
+#include "printf.h"
+
+#include "string.h"
+#include "../drivers/serial.h"
+#include "../drivers/vga.h"
+
+static const char lowerHex[] = "0123456789abcdef";
+static const char upperHex[] = "0123456789ABCDEF";
+
+// Counts everything it's given, but only stores what fits before the terminator
+typedef struct {
+    char *buffer;
+    uint32_t size;
+    uint32_t length;
+} Output;
+
+// Where the arguments come from, a va_list or an array
+typedef struct {
+    va_list *list;
+    const uint32_t *array;
+    uint32_t count;
+    uint32_t next;
+} Arguments;
+
+static inline void put(Output *out, char c) {
+    if (out->length + 1 < out->size)
+        out->buffer[out->length] = c;
+    out->length++;
+}
+
+static void putRun(Output *out, const char *chars, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        put(out, chars[i]);
+}
+
+static void pad(Output *out, char c, uint32_t count) {
+    for (; count > 0; count--)
+        put(out, c);
+}
+
+static uint32_t nextArgument(Arguments *args) {
+    if (args->array == NULL)
+        return va_arg(*args->list, uint32_t);
+    if (args->next < args->count)
+        return args->array[args->next++];
+    return 0;
+}
+
+static char *hexDigits(uint32_t value, char *end, const char *digits, uint32_t minDigits) {
+    char *start = end;
+    do {
+        *--start = digits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    while ((uint32_t)(end - start) < minDigits)
+        *--start = '0';
+    return start;
+}
+
+static void format(Output *out, const char *format, Arguments *args) {
+    for (const char *c = format; *c; c++) {
+        if (*c != '%') {
+            put(out, *c);
+            continue;
+        }
+
+        bool left = false, zero = false;
+        for (c++; *c == '-' || *c == '0'; c++) {
+            if (*c == '-')
+                left = true;
+            else
+                zero = true;
+        }
+        uint32_t width = 0;
+        for (; *c >= '0' && *c <= '9'; c++)
+            width = width * 10 + (*c - '0');
+        if (*c == 'l')
+            c++;
+
+        char digits[12];
+        char *end = digits + sizeof(digits);
+        const char *body = end;
+        const char *prefix = "";
+        uint32_t value;
+        switch (*c) {
+            case 'd':
+            case 'i':
+                value = nextArgument(args);
+                if ((int)value < 0) {
+                    prefix = "-";
+                    value = -value;
+                }
+                body = decimal_digits(value, end);
+                break;
+            case 'u':
+                body = decimal_digits(nextArgument(args), end);
+                break;
+            case 'x':
+                body = hexDigits(nextArgument(args), end, lowerHex, 1);
+                break;
+            case 'X':
+                body = hexDigits(nextArgument(args), end, upperHex, 1);
+                break;
+            case 'p':
+                prefix = "0x";
+                body = hexDigits(nextArgument(args), end, lowerHex, 8);
+                break;
+            case 'c':
+                digits[0] = (char)nextArgument(args);
+                body = digits;
+                end = digits + 1;
+                zero = false;
+                break;
+            case 's':
+                body = (const char *)nextArgument(args);
+                if (body == NULL)
+                    body = "(null)";
+                end = (char *)body + strlen((char *)body);
+                zero = false;
+                break;
+            case '%':
+                put(out, '%');
+                continue;
+            case '\0':
+                // A lone '%' ends the format
+                put(out, '%');
+                return;
+            default:
+                put(out, '%');
+                put(out, *c);
+                continue;
+        }
+
+        uint32_t prefixLength = strlen((char *)prefix);
+        uint32_t length = prefixLength + (end - body);
+        uint32_t padding = width > length ? width - length : 0;
+        if (!left && !zero)
+            pad(out, ' ', padding);
+        putRun(out, prefix, prefixLength);
+        if (!left && zero)
+            pad(out, '0', padding);
+        putRun(out, body, end - body);
+        if (left)
+            pad(out, ' ', padding);
+    }
+}
+
+static int finish(Output *out) {
+    if (out->size > 0)
+        out->buffer[out->length < out->size ? out->length : out->size - 1] = '\0';
+    return out->length;
+}
+
+int vsnprintf(char *buffer, uint32_t size, const char *fmt, va_list list) {
+    Output out = { buffer, size, 0 };
+    Arguments args = { &list, NULL, 0, 0 };
+    format(&out, fmt, &args);
+    return finish(&out);
+}
+
+int snprintf(char *buffer, uint32_t size, const char *fmt, ...) {
+    va_list list;
+    va_start(list, fmt);
+    int length = vsnprintf(buffer, size, fmt, list);
+    va_end(list);
+    return length;
+}
+
+int snprintfArgs(char *buffer, uint32_t size, const char *fmt, const uint32_t *array, uint32_t count) {
+    Output out = { buffer, size, 0 };
+    Arguments args = { NULL, array, count, 0 };
+    format(&out, fmt, &args);
+    return finish(&out);
+}
+
+int kprintf(const char *fmt, ...) {
+    char line[PRINTF_LINE_LENGTH];
+    va_list list;
+    va_start(list, fmt);
+    int length = vsnprintf(line, sizeof(line), fmt, list);
+    va_end(list);
+    if (length >= PRINTF_LINE_LENGTH)
+        length = PRINTF_LINE_LENGTH - 1;
+    vgaWriteStatic(line, length);
+    return length;
+}
+
+int serialPrintf(const char *fmt, ...) {
+    char line[PRINTF_LINE_LENGTH];
+    va_list list;
+    va_start(list, fmt);
+    int length = vsnprintf(line, sizeof(line), fmt, list);
+    va_end(list);
+    if (length >= PRINTF_LINE_LENGTH)
+        length = PRINTF_LINE_LENGTH - 1;
+    serialWriteStatic(line, length);
+    return length;
+}
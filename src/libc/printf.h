@@ -0,0 +1,36 @@
+#if !defined(PRINTF_H)
+#define PRINTF_H
+
+#include "../types.h"
+
+/* Formatted output. A line is formatted into one buffer and handed to its sink
+ * in a single write, instead of a chain of vgaWrite/vgaWriteInt calls.
+ *
+ * Conversions: %d %i %u %x %X %p %c %s %%. Each takes an optional '-' (pad on
+ * the right) or '0' (pad with zeroes) flag and a field width, e.g. "%08x" or
+ * "%-12s". An 'l' length modifier is accepted and ignored, every argument is
+ * 32 bits wide. %p prints 0x and eight hex digits. */
+
+/* The kernel includes none of the compiler's headers, types.h has its own
+ * types, so these are spelled out as what <stdarg.h> expands to */
+typedef __builtin_va_list va_list;
+#define va_start(list, last) __builtin_va_start(list, last)
+#define va_arg(list, type)   __builtin_va_arg(list, type)
+#define va_end(list)         __builtin_va_end(list)
+
+#define PRINTF_LINE_LENGTH 256   // Longest output of kprintf and serialPrintf, the rest is cut off
+
+/* Format into `buffer`, writing at most `size` bytes including the terminator.
+ * Returns the length the whole output has, which is `size` or more if it was cut off */
+int vsnprintf(char *buffer, uint32_t size, const char *format, va_list args);
+int snprintf(char *buffer, uint32_t size, const char *format, ...);
+
+/* Same, with the arguments already collected into an array, as the log ring
+ * stores them. Missing arguments read as 0 */
+int snprintfArgs(char *buffer, uint32_t size, const char *format, const uint32_t *args, uint32_t count);
+
+/* Format a line and write it to the console or COM1. Return the length written */
+int kprintf(const char *format, ...);
+int serialPrintf(const char *format, ...);
+
+#endif // PRINTF_H
@@ -0,0 +1,32 @@
+#include "ring.h"
+#include "mem.h"
+#include "../cpu/atomic.h"
+
+void spscInit(SpscRing *ring, void *storage, uint32_t capacity, uint32_t elementSize) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = capacity - 1;
+    ring->elementSize = elementSize;
+    ring->slots = (byte *)storage;
+}
+
+bool spscPush(SpscRing *ring, const void *element) {
+    uint32_t head = ring->head;
+    if (head - ring->tail > ring->mask)
+        return false;
+    memcpy((char *)element, (char *)ring->slots + (head & ring->mask) * ring->elementSize, ring->elementSize);
+    compilerBarrier(); // The element is written before the consumer can see it
+    ring->head = head + 1;
+    return true;
+}
+
+bool spscPop(SpscRing *ring, void *element) {
+    uint32_t tail = ring->tail;
+    if (ring->head == tail)
+        return false;
+    compilerBarrier(); // Read the element only after seeing it published
+    memcpy((char *)ring->slots + (tail & ring->mask) * ring->elementSize, (char *)element, ring->elementSize);
+    compilerBarrier(); // And finish reading it before handing the slot back
+    ring->tail = tail + 1;
+    return true;
+}
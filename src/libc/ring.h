@@ -0,0 +1,38 @@
+#ifndef RING_H
+#define RING_H
+
+#include "../types.h"
+
+/* Lock-free ring of fixed-size elements between one producer and one consumer,
+ * e.g. an IRQ handler and the code that processes what it captured. Neither
+ * side ever waits for the other: pushing to a full ring and popping from an
+ * empty one fail. The producer only writes `head` and the consumer only writes
+ * `tail`, which together with x86's store ordering is all the synchronization
+ * needed, also between CPUs. */
+
+typedef struct {
+    volatile uint32_t head;     // Count of elements pushed
+    volatile uint32_t tail;     // Count of elements popped
+    uint32_t mask;              // Capacity - 1
+    uint32_t elementSize;
+    byte *slots;
+} SpscRing;
+
+/* Use `storage` for `capacity` elements of `elementSize` bytes. The capacity must be a power of two */
+void spscInit(SpscRing *ring, void *storage, uint32_t capacity, uint32_t elementSize);
+
+/* Producer side, returns false and drops the element if the ring is full */
+bool spscPush(SpscRing *ring, const void *element);
+
+/* Consumer side, returns false if the ring is empty */
+bool spscPop(SpscRing *ring, void *element);
+
+static inline uint32_t spscCount(SpscRing *ring) {
+    return ring->head - ring->tail;
+}
+
+static inline bool spscEmpty(SpscRing *ring) {
+    return ring->head == ring->tail;
+}
+
+#endif // RING_H
@@ -1,9 +1,50 @@
 #include "string.h"
 
+// Word-at-a-time helpers. A word has a zero byte iff HAS_ZERO_BYTE is nonzero
+// (the classic (w - 0x01..) & ~w & 0x80.. trick). Aligned word reads never
+// cross into another page, so reading a little past the terminator is safe.
+#define ONES_BYTES  0x01010101
+#define HIGH_BYTES  0x80808080
+#define HAS_ZERO_BYTE(w) (((w) - ONES_BYTES) & ~(w) & HIGH_BYTES)
+
+#define FOLD(c)    (char)((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+#define FOLD4(c)   FOLD(c), FOLD((c) + 1), FOLD((c) + 2), FOLD((c) + 3)
+#define FOLD16(c)  FOLD4(c), FOLD4((c) + 4), FOLD4((c) + 8), FOLD4((c) + 12)
+#define FOLD64(c)  FOLD16(c), FOLD16((c) + 16), FOLD16((c) + 32), FOLD16((c) + 48)
+
+static const char foldTable[256] = { FOLD64(0), FOLD64(64), FOLD64(128), FOLD64(192) };
+
+#define PAIR(n)    (char)('0' + (n) / 10), (char)('0' + (n) % 10)
+#define PAIRS5(n)  PAIR(n), PAIR((n) + 1), PAIR((n) + 2), PAIR((n) + 3), PAIR((n) + 4)
+#define PAIRS10(n) PAIRS5(n), PAIRS5((n) + 5)
+#define PAIRS50(n) PAIRS10(n), PAIRS10((n) + 10), PAIRS10((n) + 20), PAIRS10((n) + 30), PAIRS10((n) + 40)
+
+// "00", "01", ... "99" back to back, for converting two decimal digits at once
+static const char digitPairs[200] = { PAIRS50(0), PAIRS50(50) };
+
+// Lowercase the ASCII letters of four bytes at once
+static inline uint32_t foldWord(uint32_t w) {
+    uint32_t heptets = w & 0x7F7F7F7F;
+    uint32_t atLeastA = heptets + 0x3F3F3F3F;  // high bit set for bytes >= 'A'
+    uint32_t aboveZ = heptets + 0x25252525;    // high bit set for bytes > 'Z'
+    uint32_t upper = atLeastA & ~aboveZ & ~w & HIGH_BYTES;
+    return w | (upper >> 2);                   // 0x80 >> 2 == 'a' - 'A'
+}
+
 int strlen(char s[]) {
-    int i = 0;
-    while (s[i] != '\0') ++i;
-    return i;
+    char *p = s;
+    while (((uint32_t)p & 3) != 0) {
+        if (*p == '\0')
+            return p - s;
+        p++;
+    }
+    uint32_t *w = (uint32_t *)p;
+    while (!HAS_ZERO_BYTE(*w))
+        w++;
+    p = (char *)w;
+    while (*p != '\0')
+        p++;
+    return p - s;
 }
 
 void reverse(char s[]) {
@@ -15,70 +56,101 @@ void reverse(char s[]) {
     }
 }
 
-void int32_to_ascii(uint32_t val, char str[]) {
-    int i = 0;
-    do {
-        str[i++] = val % 10 + '0';
-    } while ((val /= 10) > 0);
+char *decimal_digits(uint32_t value, char *end) {
+    // Each division yields two digits, copied from the table as a pair
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        end[0] = digitPairs[pair];
+        end[1] = digitPairs[pair + 1];
+    }
+    if (value >= 10) {
+        end -= 2;
+        end[0] = digitPairs[value * 2];
+        end[1] = digitPairs[value * 2 + 1];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
 
-    str[i] = '\0';
+// Copy the digits forward and terminate, so no reverse pass is needed
+static void copy_digits(char *digits, char *end, char str[]) {
+    while (digits < end)
+        *str++ = *digits++;
+    *str = '\0';
+}
 
-    reverse(str);
+void int32_to_ascii(uint32_t val, char str[]) {
+    char digits[10];
+    copy_digits(decimal_digits(val, digits + 10), digits + 10, str);
 }
 
 void int_to_ascii(int n, char str[]) {
-    int i, sign;
-    if ((sign = n) < 0) n = -n;
-    i = 0;
-    do {
-        str[i++] = n % 10 + '0';
-    } while ((n /= 10) > 0);
-
-    if (sign < 0) str[i++] = '-';
-    str[i] = '\0';
-
-    reverse(str);
+    if (n < 0)
+        *str++ = '-';
+    // Negating in unsigned also handles the most negative int
+    int32_to_ascii(n < 0 ? -(uint32_t)n : (uint32_t)n, str);
 }
 
 void byte_to_ascii(uint8_t byte, char str[]) {
-    int i = 0;
-    do {
-        str[i++] = byte % 10 + '0';
-    } while ((byte /= 10) > 0);
-
-    str[i] = '\0';
+    int32_to_ascii(byte, str);
+}
 
-    reverse(str);
+void hex_to_ascii(uint32_t n, char str[]) {
+    str[0] = '0';
+    str[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        uint8_t nibble = (n >> (28 - 4 * i)) & 0xF;
+        str[2 + i] = nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
+    }
+    str[10] = '\0';
 }
 
 int strcmp(char s1[], char s2[]) {
-    int i;
-    for (i = 0; s1[i] == s2[i]; i++) {
+    int i = 0;
+    // Compare a word at a time while both strings are equally aligned
+    if ((((uint32_t)s1 ^ (uint32_t)s2) & 3) == 0) {
+        for (; ((uint32_t)(s1 + i) & 3) != 0; i++) {
+            if (s1[i] != s2[i] || s1[i] == '\0')
+                return s1[i] - s2[i];
+        }
+        uint32_t *w1 = (uint32_t *)(s1 + i);
+        uint32_t *w2 = (uint32_t *)(s2 + i);
+        while (*w1 == *w2 && !HAS_ZERO_BYTE(*w1)) {
+            w1++;
+            w2++;
+        }
+        i = (char *)w1 - s1;
+    }
+    for (; s1[i] == s2[i]; i++) {
         if (s1[i] == '\0') return 0;
     }
     return s1[i] - s2[i];
 }
 
 char* strchr(char *str, char c) {
-    int i = 0;
-    while (str[i] != '\0') {
-        ++i;
-        if (str[i] == c) {
-            return str + i;
-        }
+    while (((uint32_t)str & 3) != 0) {
+        if (*str == c)
+            return str;
+        if (*str == '\0')
+            return NULL;
+        str++;
+    }
+    uint32_t pattern = (uint8_t)c * ONES_BYTES;
+    uint32_t *w = (uint32_t *)str;
+    while (!HAS_ZERO_BYTE(*w) && !HAS_ZERO_BYTE(*w ^ pattern))
+        w++;
+    for (str = (char *)w; *str != c; str++) {
+        if (*str == '\0')
+            return NULL;
     }
     return str;
 }
 
 bool strcontains(char *str, char c) {
-    int i = 0;
-    while (str[i] != '\0') {
-        ++i;
-        if (str[i] == c) {
-            return true;
-        }
-    }
-    return false;
+    return strchr(str, c) != NULL;
 }
 
 void append(char s[], char n) {
@@ -97,26 +169,62 @@ char backspace(char s[]) {
 }
 
 int findchar(char s[], char c) {
-    int i;
-    for (i = 0; s[i] != '\0'; i++) {
-        if (s[i] == c) {
-            return i;
-        }
-    }
-    return -1;
+    char *found = strchr(s, c);
+    return found ? found - s : -1;
 }
 
 char tolower(char c) {
-    if (c >= 'A' && c <= 'Z') {
-        return c + ('a' - 'A');
-    }
-    return c;
+    return foldTable[(uint8_t)c];
 }
 
 bool strequal_nocase(char *a, char *b, int nbytes) {
-    for (int i = 0; i < nbytes; i++) {
-        if (tolower(a[i]) != tolower(b[i]))
+    int i = 0;
+    for (; i + 4 <= nbytes; i += 4) {
+        uint32_t wa = *(uint32_t *)(a + i);
+        uint32_t wb = *(uint32_t *)(b + i);
+        if (wa != wb && foldWord(wa) != foldWord(wb))
+            return false;
+    }
+    for (; i < nbytes; i++) {
+        if (foldTable[(uint8_t)a[i]] != foldTable[(uint8_t)b[i]])
             return false;
     }
     return true;
+}
+
+void stringBufferInit(StringBuffer *sb, char *storage, uint32_t capacity) {
+    sb->chars = storage;
+    sb->capacity = capacity;
+    sb->length = 0;
+    sb->chars[0] = '\0';
+}
+
+void stringBufferClear(StringBuffer *sb) {
+    sb->length = 0;
+    sb->chars[0] = '\0';
+}
+
+bool stringBufferAppend(StringBuffer *sb, char c) {
+    if (sb->length + 1 >= sb->capacity)
+        return false;
+    sb->chars[sb->length++] = c;
+    sb->chars[sb->length] = '\0';
+    return true;
+}
+
+bool stringBufferAppendString(StringBuffer *sb, char *s, uint32_t len) {
+    if (sb->length + len >= sb->capacity)
+        return false;
+    for (uint32_t i = 0; i < len; i++)
+        sb->chars[sb->length + i] = s[i];
+    sb->length += len;
+    sb->chars[sb->length] = '\0';
+    return true;
+}
+
+bool stringBufferBackspace(StringBuffer *sb) {
+    if (sb->length == 0)
+        return false;
+    sb->chars[--sb->length] = '\0';
+    return true;
 }
\ No newline at end of file
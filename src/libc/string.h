@@ -1,6 +1,15 @@
 #if !defined(STRING_H)
 #define STRING_H
 #include "../types.h"
+
+/* A null-terminated string that carries its length, so appending to it
+ * doesn't rescan it. Never grows past `capacity` bytes (terminator included) */
+typedef struct {
+    char *chars;
+    uint32_t length;
+    uint32_t capacity;
+} StringBuffer;
+
 /* Get the length of a null-terminated string */
 int strlen(char s[]);
 
@@ -9,14 +18,22 @@ void reverse(char s[]);
 
 /* Convert an integer to a null-terminated string, represented in decimal */
 void int_to_ascii(int n, char str[]);
+void int32_to_ascii(uint32_t val, char str[]);
+
+/* Write `value` in decimal just before `end`, returning where the digits start.
+ * Needs up to 10 bytes and adds no terminator */
+char *decimal_digits(uint32_t value, char *end);
 
 /* Convert a byte to a null-terminated string, represented in decimal */
 void byte_to_ascii(uint8_t n, char str[]);
 
+/* Convert a number to a null-terminated string, as 0x followed by 8 hex digits */
+void hex_to_ascii(uint32_t n, char str[]);
+
 /* Compare two null-terminated strings */
 int strcmp(char s1[], char s2[]);
 
-/* Get pointer to first occurrence of char */
+/* Get pointer to first occurrence of char, or NULL if not present */
 char* strchr(char *str, char c);
 
 /* Does string contain char */
@@ -33,6 +50,18 @@ int findchar(char s[], char c);
 
 char tolower(char c);
 
+/* Compare `nbytes` bytes of two strings, ignoring ASCII case */
 bool strequal_nocase(char *a, char *b, int nbytes);
 
+/* Use `storage` (`capacity` bytes) as an empty string buffer */
+void stringBufferInit(StringBuffer *sb, char *storage, uint32_t capacity);
+void stringBufferClear(StringBuffer *sb);
+
+/* Append to the buffer, returns false (leaving it unchanged) if it would overflow */
+bool stringBufferAppend(StringBuffer *sb, char c);
+bool stringBufferAppendString(StringBuffer *sb, char *s, uint32_t len);
+
+/* Remove the last character, returns false if the buffer was empty */
+bool stringBufferBackspace(StringBuffer *sb);
+
 #endif // STRING_H
\ No newline at end of file